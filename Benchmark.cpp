@@ -0,0 +1,1247 @@
+#include <stdlib.h>
+#include <string.h>
+#include <list>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <malloc.h>
+#include <atomic>
+#include <new>
+#include "Particle.h"
+#include "Simulation.h"
+#include "PhysicsLoop.h"
+#include "SceneFile.h"
+#include "TrajectoryFile.h"
+#include "ParticleCull.h"
+
+using namespace std;
+
+/**
+ * Benchmark Driver
+ * times the physics step outside of GLUT, one mode per argument
+ * store - list of Particle objects against the ParticleStore arrays
+ * grid - all-pairs interparticle collision against the spatial hash
+ * threads - step time of a colliding pile from 1 to 64 threads
+ * simd - movement and floor kernel, scalar against AVX2 and AVX-512
+ * trails - per-particle path lists against the shared trail arena
+ * loop - physics step rate against the frame rate, with and without a physics thread
+ * scene - saving and restoring a warm multi-million particle scene
+ * record - step time with a trajectory streamed to disk and without
+ * alloc - heap allocations made by spawning and stepping once warm
+ * spawn - one particle at a time against batches from an emitter
+ * floors - linear scan of the floors against the compiled floor index
+ * sleep - growing immortal pile with resting particles asleep and awake
+ * cull - frustum culling and level of detail, scalar against AVX2 and AVX-512
+ * flags - movement loop testing every feature against the one compiled for the features on
+ * contacts - two-phase collision of a pile crowding the top of a 10 floor pyramid, 1 to 32 threads
+ * compact - quantized particle record against the full one, error, step time and memory at 10M
+ * lazy - dead particles removed every step against in batches once a share of the record is dead
+ */
+
+// environment of the reference list step, same as the Simulation defaults
+double gravity = 0.1;
+double friction = 0.2;
+float scaleFactor = 0.25;
+double spreadRandomness = 0.2;
+float firePosition[3] = { 0,15,0 };
+list<Floor> listFloors;
+
+// every allocation through operator new is counted, for the alloc benchmark
+atomic<long> heapAllocations(0);
+__attribute__((noinline)) void *operator new(size_t n) {
+	heapAllocations++;
+	void *p = malloc(n ? n : 1);
+	if (!p) { throw bad_alloc(); }
+	return p;
+}
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+	free(p);
+}
+
+// set by any check that fails, makes the benchmark exit with 2
+bool checkFailed = false;
+
+// a check's outcome as printed, recording a failure
+const char *check(bool ok) {
+	checkFailed |= !ok;
+	return ok ? "yes" : "NO";
+}
+
+// milliseconds since some fixed point
+double now() {
+	return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Reference step over the original std::list<Particle> record
+ */
+float floorCollision(Particle &p) {
+	float y = p.getPos()[1], x = p.getPos()[0], z = p.getPos()[2];
+	for (list<Floor>::iterator f = listFloors.begin(); f != listFloors.end(); ++f) {
+		if ((y < (f->getPos() + (5 * p.getSize())))
+			&& (x > (-f->getSize() - (5 * p.getSize())))
+			&& (x < (f->getSize() + (5 * p.getSize())))
+			&& (z > (-f->getSize() - (5 * p.getSize())))
+			&& (z < (f->getSize() + (5 * p.getSize())))) {
+			return f->getPos();
+		}
+	}
+	return 0;
+}
+bool recordRemovalPredicate(Particle &p) { return (p.getLife() <= 0); }
+void stepList(list<Particle> &ps) {
+	for (list<Particle>::iterator p = ps.begin(); p != ps.end(); ++p) {
+		if (p->getSpeed() != 0) { p->move(gravity); }
+		float collisionPosition = floorCollision(*p);
+		if (collisionPosition != 0) {
+			if (p->getCol() == 0) { p->changeColor(); }
+			p->bounce(collisionPosition, friction);
+			if (p->checkDead(gravity)) {
+				if (p->getCol() == 1) { p->changeColor(); }
+			}
+		}
+		p->checkOffPyramid(true, listFloors.back().getPos());
+	}
+	ps.remove_if(recordRemovalPredicate);
+}
+
+/**
+ * List versus structure-of-arrays benchmark
+ * both records are filled from the same seed and stepped the same
+ * number of times, reports the mean cost of a single step
+ */
+void benchStore() {
+	const int counts[3] = { 10000, 100000, 1000000 };
+	const int steps = 20;
+	cout << setw(10) << "particles" << setw(16) << "list ms/step"
+		<< setw(16) << "store ms/step" << setw(10) << "speedup" << endl;
+	for (int c = 0; c < 3; c++) {
+		int n = counts[c];
+		double listTime, storeTime;
+		{
+			list<Particle> ps;
+			srand(1);
+			for (int i = 0; i < n; i++) {
+				ps.push_back(Particle(firePosition, spreadRandomness, scaleFactor, i + 1, true));
+			}
+			double t = now();
+			for (int s = 0; s < steps; s++) { stepList(ps); }
+			listTime = (now() - t) / steps;
+		}
+		{
+			Simulation sim;
+			sim.randSpeed = true;
+			sim.seed(1);
+			for (int i = 0; i < n; i++) { sim.addParticle(); }
+			double t = now();
+			for (int s = 0; s < steps; s++) { sim.step(); }
+			storeTime = (now() - t) / steps;
+		}
+		cout << setw(10) << n << setw(16) << fixed << setprecision(3) << listTime
+			<< setw(16) << storeTime << setw(9) << setprecision(2) << listTime / storeTime << "x" << endl;
+	}
+}
+
+/**
+ * Reference interparticle collision, scans every particle
+ */
+void collideBrute(ParticleStore &ps) {
+	for (size_t p = 0; p < ps.count(); p++) {
+		for (size_t q = 0; q < ps.count(); q++) {
+			if (ps.id[p] != ps.id[q] && ps.color[q] == 2 && ps.color[p] == 1) {
+				double x = pow(((double)ps.x[q] - (double)ps.x[p]), 2);
+				double y = pow(((double)ps.y[q] - (double)ps.y[p]), 2);
+				double z = pow(((double)ps.z[q] - (double)ps.z[p]), 2);
+				double d = sqrt(x + y + z);
+				if (d <= ((ps.size[p] * 5) + (ps.size[q] * 5))) {
+					ps.changeDirection(p, ps.x[p] > ps.x[q], ps.z[p] > ps.z[q], ps.y[p] > ps.y[q]);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Dense pile of n particles over the top floors, half yellow and half
+ * magenta, about two particles to a grid cell
+ */
+void fillPile(Simulation &sim, int n) {
+	ParticleStore &ps = sim.particles;
+	sim.randSpeed = true;
+	sim.seed(2);
+	srand(2);
+	float extent = sqrt((float)n) * 5 * sim.scaleFactor; // keeps density fixed as n grows
+	for (int i = 0; i < n; i++) {
+		sim.addParticle();
+		ps.x[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * extent;
+		ps.z[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * extent;
+		ps.y[i] = -5 + ((float)(rand() % 10000) / 10000) * 4 * sim.scaleFactor * 5;
+		ps.color[i] = 1 + rand() % 2;
+	}
+}
+
+// true if both records hold bit-identical collision state
+bool sameState(ParticleStore &a, ParticleStore &b) {
+	return a.dx == b.dx && a.dz == b.dz && a.speed == b.speed && a.buffer == b.buffer;
+}
+
+// true if both records hold the same particles, wherever they sit
+bool sameById(const ParticleStore &a, const ParticleStore &b) {
+	if (a.count() != b.count()) { return false; }
+	vector<size_t> ia(a.count()), ib(b.count());
+	for (size_t i = 0; i < a.count(); i++) { ia[i] = ib[i] = i; }
+	sort(ia.begin(), ia.end(), [&](size_t i, size_t j) { return a.id[i] < a.id[j]; });
+	sort(ib.begin(), ib.end(), [&](size_t i, size_t j) { return b.id[i] < b.id[j]; });
+	for (size_t k = 0; k < ia.size(); k++) {
+		size_t i = ia[k], j = ib[k];
+		if (a.id[i] != b.id[j] || a.x[i] != b.x[j] || a.y[i] != b.y[j] || a.z[i] != b.z[j]
+			|| a.dx[i] != b.dx[j] || a.dz[i] != b.dz[j] || a.speed[i] != b.speed[j]
+			|| a.life[i] != b.life[j] || a.color[i] != b.color[j] || a.buffer[i] != b.buffer[j]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// floor a particle of the store sits on, as floorCollision above
+float floorCollision(const ParticleStore &ps, size_t i) {
+	float y = ps.y[i], x = ps.x[i], z = ps.z[i], s = ps.size[i];
+	for (list<Floor>::iterator f = listFloors.begin(); f != listFloors.end(); ++f) {
+		if ((y < (f->getPos() + (5 * s))) && (x > (-f->getSize() - (5 * s))) && (x < (f->getSize() + (5 * s)))
+			&& (z > (-f->getSize() - (5 * s))) && (z < (f->getSize() + (5 * s)))) {
+			return f->getPos();
+		}
+	}
+	return 0;
+}
+
+/**
+ * Reference step with interparticle collision, as the original
+ * display loop had it: in id order each particle moves, then collides
+ * against every other particle, also in id order, as it is at that moment
+ * @return collisions found
+ */
+long stepInterleaved(ParticleStore &ps) {
+	vector<size_t> order(ps.count());
+	for (size_t i = 0; i < order.size(); i++) { order[i] = i; }
+	sort(order.begin(), order.end(), [&](size_t i, size_t j) { return ps.id[i] < ps.id[j]; });
+	long hits = 0;
+	for (size_t k = 0; k < order.size(); k++) {
+		size_t p = order[k];
+		if (ps.speed[p] != 0) { ps.move(p, gravity); }
+		float collisionPosition = floorCollision(ps, p);
+		if (collisionPosition != 0) {
+			if (ps.color[p] == 0) { ps.changeColor(p); }
+			ps.bounce(p, collisionPosition, friction);
+			if (ps.checkDead(p, gravity)) {
+				if (ps.color[p] == 1) { ps.changeColor(p); }
+			}
+		}
+		ps.checkOffPyramid(p, true, listFloors.back().getPos());
+		for (size_t l = 0; l < order.size(); l++) {
+			size_t q = order[l];
+			if (q != p && ps.color[q] == 2 && ps.color[p] == 1) {
+				double x = pow(((double)ps.x[q] - (double)ps.x[p]), 2);
+				double y = pow(((double)ps.y[q] - (double)ps.y[p]), 2);
+				double z = pow(((double)ps.z[q] - (double)ps.z[p]), 2);
+				if (sqrt(x + y + z) <= ((ps.size[p] * 5) + (ps.size[q] * 5))) {
+					ps.changeDirection(p, ps.x[p] > ps.x[q], ps.z[p] > ps.z[q], ps.y[p] > ps.y[q]);
+					hits++;
+				}
+			}
+		}
+	}
+	ps.retireDead();
+	ps.removeDead();
+	return hits;
+}
+
+/**
+ * All-pairs versus spatial hash benchmark
+ * runs a few collision passes over the same pile with both
+ * and checks they leave identical velocities and debounce counters.
+ * then fires from the cannon with bumping on, against the original
+ * interleaved step, and checks both end with the same particles
+ */
+void benchGrid() {
+	const int counts[6] = { 1000, 2000, 5000, 10000, 100000, 1000000 };
+	const int passes = 5, bruteLimit = 10000;
+	cout << setw(10) << "particles" << setw(16) << "brute ms/pass"
+		<< setw(16) << "grid ms/pass" << setw(10) << "speedup" << setw(8) << "match" << endl;
+	for (int c = 0; c < 6; c++) {
+		int n = counts[c];
+		Simulation sim;
+		fillPile(sim, n);
+		ParticleStore a = sim.particles;
+		double bruteTime = 0;
+		if (n <= bruteLimit) {
+			double t = now();
+			for (int s = 0; s < passes; s++) { collideBrute(a); }
+			bruteTime = (now() - t) / passes;
+		}
+		double t = now();
+		for (int s = 0; s < passes; s++) { sim.collideParticles(); }
+		double gridTime = (now() - t) / passes;
+		cout << setw(10) << n << fixed << setprecision(3);
+		if (n <= bruteLimit) {
+			cout << setw(16) << bruteTime << setw(16) << gridTime << setw(9) << setprecision(1)
+				<< bruteTime / gridTime << "x" << setw(8) << check(sameState(a, sim.particles)) << endl;
+		}
+		else {
+			cout << setw(16) << "-" << setw(16) << gridTime << setw(10) << "-" << setw(8) << "-" << endl;
+		}
+	}
+	const int rates[3] = { 1, 3, 6 }, steps = 600;
+	cout << endl << setw(10) << "per step" << setw(10) << "threads" << setw(12) << "particles" << setw(12) << "collisions"
+		<< setw(8) << "match" << endl;
+	for (int r = 0; r < 3; r++) {
+		for (int t = 1; t <= 3; t += 2) {
+			Simulation sim;
+			sim.randSpeed = true;
+			sim.particleBumping = true;
+			sim.setThreads(t);
+			ParticleStore ref;
+			long collisions = 0;
+			for (int s = 0; s < steps; s++) {
+				for (int k = 0; k < rates[r]; k++) {
+					sim.addParticle();
+					ref.add(firePosition, spreadRandomness, scaleFactor, sim.particleCount, true, sim.randSeed);
+				}
+				sim.step();
+				collisions += stepInterleaved(ref);
+			}
+			ParticleStore live = sim.particles;
+			live.removeDead();
+			cout << setw(10) << rates[r] << setw(10) << t << setw(12) << live.count() << setw(12) << collisions
+				<< setw(8) << check(sameById(live, ref)) << endl;
+		}
+	}
+}
+
+// true if both records hold bit-identical particles
+bool sameParticles(ParticleStore &a, ParticleStore &b) {
+	return a.x == b.x && a.y == b.y && a.z == b.z && a.dx == b.dx && a.dz == b.dz
+		&& a.speed == b.speed && a.life == b.life && a.color == b.color
+		&& a.buffer == b.buffer && a.id == b.id;
+}
+
+/**
+ * Thread scaling benchmark
+ * steps the same colliding pile with 1 to 64 threads and checks
+ * every run ends bit-identical to the single threaded one
+ */
+void benchThreads() {
+	const int n = 200000, steps = 10;
+	ParticleStore reference;
+	double serialTime = 0;
+	cout << "hardware threads: " << thread::hardware_concurrency() << endl;
+	cout << setw(10) << "threads" << setw(14) << "ms/step" << setw(10) << "speedup" << setw(8) << "match" << endl;
+	for (int t = 1; t <= 64; t *= 2) {
+		Simulation sim;
+		fillPile(sim, n);
+		sim.particleBumping = true;
+		sim.setThreads(t);
+		double start = now();
+		for (int s = 0; s < steps; s++) { sim.step(); }
+		double time = (now() - start) / steps;
+		if (t == 1) {
+			reference = sim.particles;
+			serialTime = time;
+		}
+		cout << setw(10) << t << setw(14) << fixed << setprecision(3) << time << setw(9) << setprecision(2)
+			<< serialTime / time << "x" << setw(8) << check(sameParticles(reference, sim.particles)) << endl;
+	}
+}
+
+/**
+ * Step kernel microbenchmark
+ * runs the movement and floor kernel over particles scattered above and
+ * around a 10 floor pyramid with every instruction set the cpu has,
+ * reports nanoseconds per particle-step and checks each variant ends
+ * bit-identical to the scalar loop
+ */
+void benchSimd() {
+	const int n = 1000000, steps = 50;
+	Simulation sim;
+	sim.setFloors(10);
+	sim.randSpeed = true;
+	ParticleStore &ps = sim.particles;
+	sim.seed(3);
+	srand(3);
+	for (int i = 0; i < n; i++) {
+		sim.addParticle();
+		ps.x[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * 120;
+		ps.z[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * 120;
+		ps.y[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * 60;
+	}
+	FloorIndex floors;
+	floors.build(sim.listFloors);
+	vector<unsigned char> moved(n);
+	vector<float> hit(n);
+	ParticleStore start = ps, reference;
+	double scalarTime = 0;
+	cout << setw(10) << "kernel" << setw(16) << "ns/particle" << setw(10) << "speedup" << setw(8) << "match" << endl;
+	for (int isa = StepKernel::Scalar; isa <= StepKernel::detect(); isa++) {
+		StepKernel kernel;
+		kernel.setIsa((StepKernel::Isa)isa);
+		ParticleStore run = start;
+		double t = now();
+		for (int s = 0; s < steps; s++) {
+			kernel.integrate(run, 0, n, sim.gravity, moved.data());
+			kernel.floors(run, 0, n, floors, sim.friction, hit.data());
+		}
+		double time = (now() - t) * 1e6 / ((double)n * steps);
+		if (isa == StepKernel::Scalar) {
+			reference = run;
+			scalarTime = time;
+		}
+		cout << setw(10) << StepKernel::name((StepKernel::Isa)isa) << setw(16) << fixed << setprecision(3) << time
+			<< setw(9) << setprecision(2) << scalarTime / time << "x" << setw(8)
+			<< check(sameParticles(reference, run)) << endl;
+	}
+}
+
+/**
+ * Function which builds the window's default view, as gluPerspective
+ * and gluLookAt would, column major
+ * @param clip - projection times view
+ * @param eye - camera position
+ */
+void defaultView(float clip[16], float eye[3]) {
+	double yRotate = 212.50, zoom = 50, xRotate = 25, aspect = 1;
+	double e[3] = { zoom * cos(yRotate), xRotate, zoom * sin(yRotate) }, c[3] = { 0, -20, 0 }, up[3] = { 0, 1, 0 };
+	double f[3] = { c[0] - e[0], c[1] - e[1], c[2] - e[2] };
+	double fl = sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+	for (int k = 0; k < 3; k++) { f[k] /= fl; }
+	double s[3] = { f[1] * up[2] - f[2] * up[1], f[2] * up[0] - f[0] * up[2], f[0] * up[1] - f[1] * up[0] };
+	double sl = sqrt(s[0] * s[0] + s[1] * s[1] + s[2] * s[2]);
+	for (int k = 0; k < 3; k++) { s[k] /= sl; }
+	double u[3] = { s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0] };
+	double view[16] = { s[0], u[0], -f[0], 0, s[1], u[1], -f[1], 0, s[2], u[2], -f[2], 0, 0, 0, 0, 1 };
+	for (int r = 0; r < 3; r++) { view[12 + r] = -(view[r] * e[0] + view[4 + r] * e[1] + view[8 + r] * e[2]); }
+	double near = 2, far = 300, cot = 1 / tan(37 * M_PI / 180);
+	double proj[16] = { cot / aspect, 0, 0, 0, 0, cot, 0, 0, 0, 0, (far + near) / (near - far), -1,
+		0, 0, 2 * far * near / (near - far), 0 };
+	for (int col = 0; col < 4; col++) {
+		for (int r = 0; r < 4; r++) {
+			double v = 0;
+			for (int k = 0; k < 4; k++) { v += proj[k * 4 + r] * view[col * 4 + k]; }
+			clip[col * 4 + r] = (float)v;
+		}
+	}
+	for (int k = 0; k < 3; k++) { eye[k] = (float)e[k]; }
+}
+
+/**
+ * Culling benchmark
+ * sorts 1M particles scattered well beyond the default view of an
+ * 800x800 window into culled, full mesh, coarse mesh and point with
+ * every instruction set the cpu has, reports nanoseconds per particle
+ * and checks each variant agrees with the scalar loop
+ */
+void benchCull() {
+	const int n = 1000000, reps = 20;
+	ParticleStore ps;
+	float fp[3] = { 0, 15, 0 };
+	srand(5);
+	for (int i = 0; i < n; i++) {
+		ps.add(fp, 0.2, 0.25f, i, false, 5);
+		ps.x[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * 600;
+		ps.y[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * 200;
+		ps.z[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * 600;
+	}
+	float clip[16], eye[3];
+	defaultView(clip, eye);
+	vector<unsigned char> lod(n), reference;
+	double scalarTime = 0;
+	cout << setw(10) << "kernel" << setw(16) << "ns/particle" << setw(10) << "speedup" << setw(8) << "match" << endl;
+	for (int isa = StepKernel::Scalar; isa <= StepKernel::detect(); isa++) {
+		ParticleCull cull;
+		cull.setIsa((StepKernel::Isa)isa);
+		cull.setView(clip, eye, (float)(400 / tan(37 * M_PI / 180)), 8, 1.5f);
+		double t = now();
+		for (int r = 0; r < reps; r++) { cull.classify(ps, 0, n, lod.data()); }
+		double time = (now() - t) * 1e6 / ((double)n * reps);
+		if (isa == StepKernel::Scalar) {
+			reference = lod;
+			scalarTime = time;
+		}
+		cout << setw(10) << StepKernel::name((StepKernel::Isa)isa) << setw(16) << fixed << setprecision(3) << time
+			<< setw(9) << setprecision(2) << scalarTime / time << "x" << setw(8) << check(lod == reference) << endl;
+	}
+	size_t counts[4] = { 0, 0, 0, 0 };
+	for (int i = 0; i < n; i++) { counts[reference[i]]++; }
+	cout << "culled " << counts[ParticleCull::Culled] << ", full " << counts[ParticleCull::Full] << ", coarse "
+		<< counts[ParticleCull::Low] << ", points " << counts[ParticleCull::Point] << endl;
+}
+
+// bytes currently allocated on the heap
+double heapBytes() {
+	return (double)mallinfo2().uordblks;
+}
+
+/**
+ * Path storage benchmark
+ * 10k particles with paths on fall past an empty pyramid for 500 steps,
+ * so no path is ever cut short. reports the heap the paths hold, the
+ * step time and the cost of preparing one frame of path lines, a copy
+ * of every list walked into vertex pairs as the old renderer did
+ * against the segment indices of the arena
+ */
+void benchTrails() {
+	const int n = 10000, steps = 500, frames = 20, capacity = 64;
+	double listHeap, listStep, listFrame, arenaHeap, arenaStep, arenaFrame;
+	size_t listSegments = 0, arenaSegments = 0;
+	{
+		double base = heapBytes();
+		list<Particle> ps;
+		srand(1);
+		for (int i = 0; i < n; i++) {
+			ps.push_back(Particle(firePosition, spreadRandomness, scaleFactor, i + 1, true));
+		}
+		double t = now();
+		for (int s = 0; s < steps; s++) {
+			for (list<Particle>::iterator p = ps.begin(); p != ps.end(); ++p) { p->move(gravity); }
+		}
+		listStep = (now() - t) / steps;
+		listHeap = heapBytes() - base;
+		vector<float> lines;
+		t = now();
+		for (int f = 0; f < frames; f++) {
+			lines.clear();
+			for (list<Particle>::iterator p = ps.begin(); p != ps.end(); ++p) {
+				list<Line> path = p->getPath();
+				Line lp = path.front();
+				for (list<Line>::iterator l = path.begin(); l != path.end(); ++l) {
+					array<float, 3> a = lp.getPos(), b = l->getPos(); // connect l1 to l2
+					lines.insert(lines.end(), a.begin(), a.end());
+					lines.insert(lines.end(), b.begin(), b.end());
+					lp = *l;
+				}
+			}
+		}
+		listFrame = (now() - t) / frames;
+		listSegments = lines.size() / 6;
+	}
+	{
+		double base = heapBytes();
+		Simulation sim;
+		sim.randSpeed = true;
+		sim.setFloors(0);
+		sim.particles.setTrailCapacity(capacity);
+		sim.seed(1);
+		for (int i = 0; i < n; i++) { sim.addParticle(); }
+		double t = now();
+		for (int s = 0; s < steps; s++) { sim.step(); }
+		arenaStep = (now() - t) / steps;
+		arenaHeap = heapBytes() - base;
+		vector<unsigned int> indices;
+		t = now();
+		for (int f = 0; f < frames; f++) {
+			indices.clear();
+			for (size_t p = 0; p < sim.particles.count(); p++) { sim.particles.trailSegments(p, indices); }
+		}
+		arenaFrame = (now() - t) / frames;
+		arenaSegments = indices.size() / 2;
+	}
+	cout << setw(10) << "paths" << setw(12) << "heap MB" << setw(14) << "ms/step"
+		<< setw(14) << "ms/frame" << setw(12) << "segments" << endl;
+	cout << setw(10) << "list" << setw(12) << fixed << setprecision(2) << listHeap / 1048576
+		<< setw(14) << setprecision(3) << listStep << setw(14) << listFrame << setw(12) << listSegments << endl;
+	cout << setw(10) << "arena" << setw(12) << setprecision(2) << arenaHeap / 1048576
+		<< setw(14) << setprecision(3) << arenaStep << setw(14) << arenaFrame << setw(12) << arenaSegments << endl;
+}
+
+/**
+ * Fixed timestep benchmark
+ * a stand-in renderer that sleeps for a set frame time drives the physics
+ * loop for two seconds, once stepping on the render thread and once with
+ * the physics on its own thread. the steps per second should stay at the
+ * fixed rate of 50 however fast or slow the frames are
+ */
+void benchLoop() {
+	const int frameTimes[3] = { 5, 40, 120 };
+	const double seconds = 2;
+	cout << setw(10) << "frame ms" << setw(10) << "physics" << setw(12) << "frames/s"
+		<< setw(12) << "steps/s" << setw(12) << "particles" << endl;
+	for (int threaded = 0; threaded < 2; threaded++) {
+		for (int f = 0; f < 3; f++) {
+			Simulation sim;
+			PhysicsLoop loop(sim);
+			loop.onStep = [&]() { sim.addParticle(); }; // constant fire
+			sim.seed(1);
+			loop.setThreaded(threaded != 0);
+			int frames = 0;
+			double t = now();
+			long firstStep = loop.frame().steps;
+			while (now() - t < seconds * 1000) {
+				loop.advance();
+				Snapshot &frame = loop.frame();
+				(void)frame; // drawing would read the snapshot here
+				this_thread::sleep_for(chrono::milliseconds(frameTimes[f]));
+				frames++;
+			}
+			loop.setThreaded(false);
+			double elapsed = (now() - t) / 1000;
+			Snapshot &frame = loop.frame();
+			cout << setw(10) << frameTimes[f] << setw(10) << (threaded ? "thread" : "render")
+				<< setw(12) << fixed << setprecision(1) << frames / elapsed
+				<< setw(12) << (frame.steps - firstStep) / elapsed << setw(12) << frame.particles.count() << endl;
+		}
+	}
+}
+
+// true if both scenes hold the same particles, paths and cannon state
+bool sameScene(Simulation &a, Simulation &b) {
+	ParticleStore &p = a.particles, &q = b.particles;
+	return sameParticles(p, q) && p.y == q.y && p.dy == q.dy && p.size == q.size
+		&& p.lineDivisor == q.lineDivisor && p.trailPoints == q.trailPoints
+		&& p.trailSlot == q.trailSlot && p.trailHead == q.trailHead && p.trailLength == q.trailLength
+		&& p.awake == q.awake && a.randSeed == b.randSeed && a.particleCount == b.particleCount;
+}
+
+/**
+ * Scene file benchmark
+ * builds a warm scene of 2M immortal particles with 16 point paths and
+ * two emitters, one bursting, saves it and loads it into a fresh
+ * simulation. the restored scene has to match, and keep matching once
+ * both fire from their own emitters and step some more. then a small
+ * scene is saved with one trail field, colour or floor count at a time
+ * out of range, and each file has to be refused without touching the
+ * scene it was loaded into. a compact scene has to be refused by save
+ * and taken out of compact mode by load
+ */
+void benchScene() {
+	const int n = 2000000, warmSteps = 40, checkSteps = 20;
+	const char *path = "bench_scene.psim";
+	Simulation sim, restored;
+	sim.setFloors(10);
+	sim.randSpeed = true;
+	sim.removeParticles = false;
+	sim.particles.setTrailCapacity(16);
+	float left[3] = { -3, 15, 0 }, right[3] = { 3, 14, 1 };
+	sim.emitters.push_back(Emitter(left, 50, 0.3, true));
+	sim.emitters.push_back(Emitter(right, 10, 0.1, false));
+	sim.emitters.back().setBurst(200, 7);
+	double t = now();
+	for (int i = 0; i < n; i++) { sim.addParticle(); }
+	for (int s = 0; s < warmSteps; s++) {
+		sim.emit();
+		sim.step();
+	}
+	double buildTime = now() - t;
+	t = now();
+	bool saved = SceneFile::save(sim, path);
+	double saveTime = now() - t;
+	t = now();
+	bool loaded = saved && SceneFile::load(restored, path);
+	double loadTime = now() - t;
+	struct stat st;
+	double megabytes = (stat(path, &st) == 0) ? st.st_size / 1048576.0 : 0;
+	remove(path);
+	bool match = loaded && sameScene(sim, restored);
+	for (int s = 0; s < checkSteps && match; s++) {
+		sim.emit(); sim.step();
+		restored.emit(); restored.step();
+	}
+	match = match && sameScene(sim, restored);
+	cout << setw(10) << "particles" << setw(12) << "file MB" << setw(12) << "build ms"
+		<< setw(12) << "save ms" << setw(12) << "load ms" << setw(8) << "match" << endl;
+	cout << setw(10) << sim.particles.count() << setw(12) << fixed << setprecision(1) << megabytes
+		<< setw(12) << buildTime << setw(12) << saveTime << setw(12) << loadTime
+		<< setw(8) << check(match) << endl;
+	Simulation small, target;
+	small.particles.setTrailCapacity(4);
+	for (int s = 0; s < 300; s++) { // fires 5 a step for particles that have died and freed their slots
+		for (int i = 0; i < 5; i++) { small.addParticle(); }
+		small.step();
+	}
+	small.particles.removeDead();
+	bool kept = SceneFile::save(small, path) && SceneFile::load(target, path) && !small.particles.freeSlots.empty();
+	ParticleStore &ps = small.particles;
+	const int damages = 11;
+	int *fields[damages] = { &ps.trailCapacity, &ps.trailSlot[0], &ps.trailHead[1], &ps.trailLength[2], &ps.trailLength[3],
+		&ps.freeSlots[0], &ps.color[4], &ps.color[5], &small.numFloors, &small.numFloors, &small.numFloors };
+	int bad[damages] = { -1, (int)(ps.trailPoints.size() / 12), 4, 5, -1, -2, 3, -1, 11, -1, 0 };
+	const char *names[damages] = { "capacity", "slot", "head", "length", "length", "free slot", "colour", "colour",
+		"floors", "floors", "floors" };
+	cout << endl << setw(10) << "damaged" << setw(8) << "value" << setw(10) << "refused" << setw(10) << "untouched" << endl;
+	for (int d = 0; d < damages; d++) {
+		int good = *fields[d];
+		*fields[d] = bad[d];
+		bool refused = SceneFile::save(small, path) && !SceneFile::load(target, path);
+		*fields[d] = good;
+		cout << setw(10) << names[d] << setw(8) << bad[d] << setw(10) << check(refused)
+			<< setw(10) << check(kept && sameScene(small, target)) << endl;
+	}
+	Simulation packed; // a compact scene has no particles in the full record to save
+	for (int i = 0; i < 100; i++) { packed.addParticle(); }
+	packed.setCompact(true);
+	packed.step();
+	bool refusedPacked = !SceneFile::save(packed, path);
+	bool unpacked = SceneFile::save(small, path) && SceneFile::load(packed, path) && !packed.isCompact()
+		&& packed.compact.count() == 0 && sameScene(small, packed);
+	cout << endl << "compact save refused " << check(refusedPacked) << ", load leaves compact mode " << check(unpacked) << endl;
+	remove(path);
+}
+
+/**
+ * Trajectory recording benchmark
+ * steps 100k particles with every step recorded, raw and, when built
+ * with USE_ZLIB, compressed, against not recording at all. the step
+ * only pays for the copy unless the I/O thread falls behind
+ */
+void benchRecord() {
+	const int n = 100000, steps = 100;
+	const char *path = "bench_trajectory.ptrj";
+	int modes = 2;
+#ifdef USE_ZLIB
+	modes = 3;
+#endif
+	cout << setw(10) << "trajectory" << setw(12) << "ms/step" << setw(12) << "file MB" << setw(10) << "stalls"
+		<< setw(10) << "written" << endl;
+	for (int m = 0; m < modes; m++) {
+		Simulation sim;
+		sim.randSpeed = true;
+		sim.removeParticles = false;
+		for (int i = 0; i < n; i++) { sim.addParticle(); }
+		TrajectoryWriter writer;
+		bool opened = (m == 0) || writer.open(path, m == 2, 16);
+		double t = now();
+		for (int s = 0; s < steps; s++) {
+			sim.step();
+			writer.record(sim.particles, s + 1);
+		}
+		bool written = writer.close() && opened;
+		double time = (now() - t) / steps;
+		struct stat st;
+		double megabytes = (m > 0 && stat(path, &st) == 0) ? st.st_size / 1048576.0 : 0;
+		remove(path);
+		const char *names[3] = { "off", "raw", "zlib" };
+		cout << setw(10) << names[m] << setw(12) << fixed << setprecision(3) << time
+			<< setw(12) << setprecision(1) << megabytes << setw(10) << writer.getStalls()
+			<< setw(10) << check(written) << endl;
+	}
+}
+
+/**
+ * Allocation benchmark
+ * fires and steps a scene until the record has reached its size, then
+ * counts the heap allocations of further steps. the steady scene fires
+ * at a constant rate with paths and collision on and is counted once
+ * warm, the burst scene fires 5k particles at once every 100 steps into
+ * a reserved record and is counted from the first step
+ */
+void benchAlloc() {
+	const int steps = 1000;
+	cout << setw(10) << "scene" << setw(12) << "particles" << setw(12) << "ms/step"
+		<< setw(14) << "allocations" << setw(8) << "zero" << endl;
+	for (int scene = 0; scene < 2; scene++) {
+		Simulation sim;
+		sim.randSpeed = true;
+		sim.particles.setTrailCapacity(64);
+		if (scene == 0) { sim.particleBumping = true; }
+		else { sim.reserve(20000); } // up to three bursts are alive at once
+		int warm = (scene == 0) ? 1500 : 0;
+		long allocations = 0;
+		double t = 0;
+		for (int s = 0; s < warm + steps; s++) {
+			if (s == warm) {
+				allocations = heapAllocations;
+				t = now();
+			}
+			if (scene == 0) { sim.addParticle(); }
+			else if (s % 100 == 0) {
+				for (int i = 0; i < 5000; i++) { sim.addParticle(); }
+			}
+			sim.step();
+		}
+		allocations = heapAllocations - allocations;
+		double time = (now() - t) / steps;
+		cout << setw(10) << ((scene == 0) ? "steady" : "burst") << setw(12) << sim.particles.count()
+			<< setw(12) << fixed << setprecision(3) << time << setw(14) << allocations
+			<< setw(8) << check(allocations == 0) << endl;
+	}
+}
+
+/**
+ * Spawning benchmark
+ * fires 1M particles from the cannon one addParticle at a time and in
+ * batches of 1k to 100k from an emitter at the same spot, and checks
+ * both give the same record
+ */
+void benchSpawn() {
+	const int n = 1000000, rounds = 5;
+	const int batches[3] = { 1000, 10000, 100000 };
+	Simulation single;
+	double singleTime = 0;
+	for (int r = 0; r < rounds; r++) {
+		single.particles.clear();
+		single.particleCount = 0;
+		double t = now();
+		for (int i = 0; i < n; i++) { single.addParticle(); }
+		singleTime += (now() - t) / rounds;
+	}
+	cout << setw(10) << "batch" << setw(12) << "ms" << setw(10) << "speedup" << setw(8) << "same" << endl;
+	cout << setw(10) << 1 << setw(12) << fixed << setprecision(3) << singleTime << setw(10) << "" << setw(8) << "" << endl;
+	for (int b = 0; b < 3; b++) {
+		Simulation batched;
+		Emitter cannon(batched.firePosition, batches[b], batched.spreadRandomness, batched.randSpeed);
+		double time = 0;
+		for (int r = 0; r < rounds; r++) {
+			batched.particles.clear();
+			batched.particleCount = 0;
+			double t = now();
+			for (int i = 0; i < n; i += batches[b]) { batched.addParticles(cannon, batches[b]); }
+			time += (now() - t) / rounds;
+		}
+		cout << setw(10) << batches[b] << setw(12) << time << setw(9) << setprecision(2) << singleTime / time << "x"
+			<< setw(8) << check(batched.particles.checksum() == single.particles.checksum()) << setprecision(3) << endl;
+	}
+}
+
+/**
+ * Floor lookup benchmark
+ * 1M points around three floor layouts: the default 10 floor pyramid,
+ * an irregular stack that still widens going down, and the same floors
+ * shuffled. times the linear scan of the floors against the index
+ * lookup and the slab fallback, and checks all find the same floor.
+ * the floor kernel of every instruction set is checked against the scan
+ */
+void benchFloors() {
+	const int n = 1000000;
+	const char *names[3] = { "pyramid", "nested", "shuffled" };
+	const float nestedPos[7] = { -3, -4, -8, -9, -15, -16, -30 };
+	const float nestedSize[7] = { 2, 6, 7, 15, 16, 30, 40 };
+	vector<float> px(n), py(n), pz(n);
+	srand(4);
+	for (int i = 0; i < n; i++) {
+		px[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * 120;
+		pz[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * 120;
+		py[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * 80;
+	}
+	const float r = 5 * 0.25f;
+	cout << setw(10) << "layout" << setw(10) << "index" << setw(12) << "scan ns" << setw(12) << "index ns"
+		<< setw(12) << "slabs ns" << setw(8) << "match" << setw(8) << "kernel" << endl;
+	for (int layout = 0; layout < 3; layout++) {
+		list<Floor> floors;
+		if (layout == 0) {
+			for (double i = -5.0, j = 5.0, k = 10; k != 0; i -= 2.5, j += 5, k--) { floors.push_back(Floor(i, j)); }
+		}
+		else {
+			for (int k = 0; k < 7; k++) { floors.push_back(Floor(nestedPos[k], nestedSize[k])); }
+			if (layout == 2) { // a fixed shuffle, narrow floors end up below wide ones
+				vector<Floor> v(floors.begin(), floors.end());
+				swap(v[0], v[5]); swap(v[1], v[3]); swap(v[2], v[6]);
+				floors.assign(v.begin(), v.end());
+			}
+		}
+		FloorIndex index;
+		index.build(floors);
+		vector<float> fp, fs;
+		for (list<Floor>::iterator f = floors.begin(); f != floors.end(); ++f) {
+			fp.push_back(f->getPos());
+			fs.push_back(f->getSize());
+		}
+		int nf = (int)fp.size();
+		vector<int> scan(n), found(n), slabs(n);
+		double t = now();
+		for (int i = 0; i < n; i++) { // the lookup as the step did it before the index
+			scan[i] = -1;
+			for (int k = 0; k < nf; k++) {
+				if ((py[i] < (fp[k] + r)) && (px[i] > (-fs[k] - r)) && (px[i] < (fs[k] + r))
+					&& (pz[i] > (-fs[k] - r)) && (pz[i] < (fs[k] + r))) {
+					scan[i] = k;
+					break;
+				}
+			}
+		}
+		double scanTime = (now() - t) * 1e6 / n;
+		t = now();
+		for (int i = 0; i < n; i++) { found[i] = index.firstHit(px[i], py[i], pz[i], r); }
+		double indexTime = (now() - t) * 1e6 / n;
+		t = now();
+		for (int i = 0; i < n; i++) { slabs[i] = index.firstHitSlabs(max(fabsf(px[i]), fabsf(pz[i])), py[i], r); }
+		double slabTime = (now() - t) * 1e6 / n;
+		// every kernel against the scan, particles placed at the points
+		bool kernelMatch = true;
+		Simulation sim;
+		for (int i = 0; i < n; i++) { sim.addParticle(); }
+		for (int isa = StepKernel::Scalar; isa <= StepKernel::detect(); isa++) {
+			StepKernel kernel;
+			kernel.setIsa((StepKernel::Isa)isa);
+			ParticleStore run = sim.particles;
+			run.x = px; run.y = py; run.z = pz;
+			vector<float> hit(n);
+			kernel.floors(run, 0, n, index, sim.friction, hit.data());
+			for (int i = 0; i < n && kernelMatch; i++) {
+				kernelMatch = (hit[i] == ((scan[i] >= 0) ? fp[scan[i]] : 0));
+			}
+		}
+		cout << setw(10) << names[layout] << setw(10) << FloorIndex::name(index.getLayout())
+			<< setw(12) << fixed << setprecision(3) << scanTime << setw(12) << indexTime << setw(12) << slabTime
+			<< setw(8) << check(scan == found && scan == slabs) << setw(8) << check(kernelMatch) << endl;
+	}
+}
+
+/**
+ * Sleeping benchmark
+ * fires 50 immortal particles a step onto the default pyramid, or 5
+ * with bumping on, once with resting particles put to sleep and
+ * once with every particle stepped. reports the step time over the
+ * last stretch, when most of the pile is at rest, and checks both runs
+ * end with the same particles
+ */
+void benchSleep() {
+	const int rate = 50, steps = 200;
+	cout << setw(10) << "bumping" << setw(12) << "particles" << setw(10) << "asleep" << setw(14) << "awake ms"
+		<< setw(14) << "sleeping ms" << setw(10) << "speedup" << setw(8) << "same" << endl;
+	for (int bumping = 0; bumping < 2; bumping++) {
+		Simulation runs[2];
+		double time[2];
+		for (int r = 0; r < 2; r++) {
+			Simulation &sim = runs[r];
+			sim.randSpeed = true;
+			sim.removeParticles = false;
+			sim.particleBumping = (bumping == 1);
+			sim.sleeping = (r == 1);
+			sim.emitters.push_back(Emitter(sim.firePosition, (bumping == 1) ? rate / 10 : rate, sim.spreadRandomness, true));
+			int warm = (bumping == 1) ? 1000 : 2500;
+			double t = 0;
+			for (int s = 0; s < warm + steps; s++) {
+				if (s == warm) { t = now(); }
+				sim.emit();
+				sim.step();
+			}
+			time[r] = (now() - t) / steps;
+		}
+		cout << setw(10) << (bumping ? "on" : "off") << setw(12) << runs[1].particles.count()
+			<< setw(10) << runs[1].particles.sleeping() << setw(14) << fixed << setprecision(3) << time[0]
+			<< setw(14) << time[1] << setw(9) << setprecision(2) << time[0] / time[1] << "x"
+			<< setw(8) << check(sameById(runs[0].particles, runs[1].particles)) << endl;
+	}
+}
+
+/**
+ * Feature specialization benchmark
+ * steps particles scattered above and around the pyramid with every
+ * combination of floors, trails and removal, once through the loop that
+ * tests each feature per particle and once through the one compiled for
+ * the combination. sleeping is off so every particle is moved. reports
+ * the step time of both and checks they end with the same particles,
+ * divisors and trails
+ */
+void benchFlags() {
+	const int n = 500000, steps = 30;
+	cout << setw(8) << "floors" << setw(8) << "trails" << setw(8) << "remove" << setw(14) << "checked ms"
+		<< setw(16) << "specialized ms" << setw(10) << "speedup" << setw(8) << "same" << endl;
+	for (int flags = 0; flags < 8; flags++) {
+		bool floors = (flags & 4) != 0, trails = (flags & 2) != 0, remove = (flags & 1) != 0;
+		Simulation runs[2];
+		double time[2];
+		for (int r = 0; r < 2; r++) {
+			Simulation &sim = runs[r];
+			sim.setFloors(floors ? 10 : 0);
+			sim.removeParticles = remove;
+			sim.sleeping = false;
+			sim.specialized = (r == 1);
+			sim.randSpeed = true;
+			sim.particles.setTrailCapacity(trails ? 8 : 0);
+			ParticleStore &ps = sim.particles;
+			sim.seed(3);
+			srand(3);
+			for (int i = 0; i < n; i++) {
+				sim.addParticle();
+				ps.x[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * 120;
+				ps.z[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * 120;
+				ps.y[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * 60;
+			}
+			double t = now();
+			for (int s = 0; s < steps; s++) { sim.step(); }
+			time[r] = (now() - t) / steps;
+		}
+		ParticleStore &a = runs[0].particles, &b = runs[1].particles;
+		bool same = sameParticles(a, b) && a.lineDivisor == b.lineDivisor && a.trailPoints == b.trailPoints
+			&& a.trailLength == b.trailLength;
+		cout << setw(8) << (floors ? "on" : "off") << setw(8) << (trails ? "on" : "off") << setw(8)
+			<< (remove ? "on" : "off") << setw(14) << fixed << setprecision(3) << time[0] << setw(16) << time[1]
+			<< setw(9) << setprecision(2) << time[0] / time[1] << "x" << setw(8) << check(same) << endl;
+	}
+}
+
+/**
+ * Contact pipeline benchmark
+ * a 10 floor pyramid with an eighth of the particles crowded onto the
+ * top floor, hundreds to a grid cell, and the rest spread thinly over
+ * the floors below, half yellow and half magenta. runs the collision pass
+ * alone with 1 to 32 threads, so the crowded cells make the work
+ * uneven, and checks every run leaves the same velocities and
+ * debounce counters as the single threaded one
+ */
+void benchContacts() {
+	const int n = 160000, passes = 5;
+	ParticleStore reference;
+	double serialTime = 0;
+	cout << "hardware threads: " << thread::hardware_concurrency() << endl;
+	cout << setw(10) << "threads" << setw(14) << "ms/pass" << setw(10) << "speedup" << setw(8) << "match" << endl;
+	for (int t = 1; t <= 32; t *= 2) {
+		Simulation sim;
+		sim.setFloors(10);
+		sim.setThreads(t);
+		ParticleStore &ps = sim.particles;
+		sim.randSpeed = true;
+		sim.seed(4);
+		srand(4);
+		for (int i = 0; i < n; i++) {
+			sim.addParticle();
+			bool top = (i % 8 == 0);
+			float extent = top ? 10 : 100, r = (float)(rand() % 10000) / 10000;
+			ps.x[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * extent;
+			ps.z[i] = ((float)(rand() % 10000) / 10000 - 0.5f) * extent;
+			ps.y[i] = top ? -4.9f + r * 5 : -28 + r * 23;
+			ps.color[i] = 1 + rand() % 2;
+		}
+		double start = now();
+		for (int s = 0; s < passes; s++) { sim.collideParticles(); }
+		double time = (now() - start) / passes;
+		if (t == 1) {
+			reference = sim.particles;
+			serialTime = time;
+		}
+		cout << setw(10) << t << setw(14) << fixed << setprecision(3) << time << setw(9) << setprecision(2)
+			<< serialTime / time << "x" << setw(8) << check(sameState(reference, sim.particles)) << endl;
+	}
+}
+
+// resident memory of the process, from /proc
+double residentBytes() {
+	long pages = 0, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (f) {
+		if (fscanf(f, "%ld %ld", &pages, &resident) != 2) { resident = 0; }
+		fclose(f);
+	}
+	return (double)resident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Function which scatters n particles over and around a 10 floor
+ * pyramid, falling at random speeds, fired in batches and packed as
+ * they come when the simulation is compact
+ * @param compact - whether to keep the particles compact
+ */
+void scatterOverPyramid(Simulation &sim, int n, bool compact) {
+	sim.setFloors(10);
+	sim.randSpeed = true;
+	sim.seed(5);
+	sim.setCompact(compact); // after the floors, which the compact box is fitted to
+	sim.compact.reserve(n);
+	srand(5);
+	for (int done = 0; done < n;) {
+		int batch = min(n - done, 1000000);
+		ParticleStore &ps = sim.particles;
+		for (int i = 0; i < batch; i++) {
+			sim.addParticle();
+			size_t k = ps.count() - 1;
+			ps.x[k] = ((float)(rand() % 10000) / 10000 - 0.5f) * 110;
+			ps.z[k] = ((float)(rand() % 10000) / 10000 - 0.5f) * 110;
+			ps.y[k] = -25 + ((float)(rand() % 10000) / 10000) * 35;
+		}
+		if (sim.isCompact()) { sim.packFired(); }
+		done += batch;
+	}
+	if (sim.isCompact()) { sim.particles = ParticleStore(); } // the staging record is not kept at this size
+}
+
+/**
+ * Compact record benchmark
+ * first steps 1M particles scattered over the pyramid with the full
+ * record and with the compact one and compares the particles alive in
+ * both. those that have fallen past the pyramid only count down their
+ * life, and the compact record clamps them to its box, so they are left
+ * out. a particle rounded across a floor's edge bounces in one record
+ * and falls in the other, so those that differ by more than divergence
+ * are counted apart and the position and speed differences are over the
+ * rest. then times
+ * steps of 10M particles with each and reports the memory the process
+ * holds for them
+ */
+void benchCompact() {
+	{
+		const int n = 1000000;
+		cout << "error against the full record, " << n << " particles" << endl;
+		const double divergence = 0.05;
+		cout << setw(8) << "steps" << setw(10) << "alive" << setw(10) << "compact" << setw(10) << "fallen" << setw(12) << "max pos"
+			<< setw(12) << "mean pos" << setw(12) << "max speed" << setw(10) << "diverged" << setw(10) << "colour"
+			<< setw(10) << "life" << endl;
+		Simulation full, compact;
+		scatterOverPyramid(full, n, false);
+		scatterOverPyramid(compact, n, true);
+		float killPlane = 0;
+		for (list<Floor>::iterator f = full.listFloors.begin(); f != full.listFloors.end(); ++f) {
+			killPlane = min(killPlane, (float)f->getPos());
+		}
+		for (int s = 1; s <= 200; s++) {
+			full.step();
+			compact.step();
+			if (s != 1 && s != 10 && s != 50 && s != 100 && s != 200) { continue; }
+			ParticleStore a = full.particles, b;
+			compact.compact.unpack(b);
+			vector<size_t> ia(a.count()), ib(b.count());
+			for (size_t i = 0; i < a.count(); i++) { ia[i] = i; }
+			for (size_t i = 0; i < b.count(); i++) { ib[i] = i; }
+			sort(ia.begin(), ia.end(), [&](size_t i, size_t j) { return a.id[i] < a.id[j]; });
+			sort(ib.begin(), ib.end(), [&](size_t i, size_t j) { return b.id[i] < b.id[j]; });
+			double maxPos = 0, sumPos = 0, maxSpeed = 0;
+			size_t fallen = 0, tracking = 0, diverged = 0, colours = 0, lives = 0;
+			for (size_t u = 0, v = 0; u < ia.size() && v < ib.size();) {
+				size_t i = ia[u], j = ib[v];
+				if (a.id[i] < b.id[j]) { u++; continue; }
+				if (a.id[i] > b.id[j]) { v++; continue; }
+				u++; v++;
+				if (a.y[i] < killPlane) {
+					fallen++;
+					continue;
+				}
+				double d = max(max(fabs(a.x[i] - b.x[j]), fabs(a.y[i] - b.y[j])), fabs(a.z[i] - b.z[j]));
+				colours += (a.color[i] != b.color[j]);
+				lives += (a.life[i] != b.life[j]);
+				if (d > divergence) {
+					diverged++;
+					continue;
+				}
+				maxPos = max(maxPos, d);
+				sumPos += d;
+				maxSpeed = max(maxSpeed, (double)fabs(a.speed[i] - b.speed[j]));
+				tracking++;
+			}
+			cout << setw(8) << s << setw(10) << a.count() << setw(10) << b.count() << setw(10) << fallen << setw(12) << scientific
+				<< setprecision(2) << maxPos << setw(12) << sumPos / max(tracking, (size_t)1) << setw(12) << maxSpeed
+				<< setw(10) << diverged << setw(10) << colours << setw(10) << lives << endl;
+		}
+		cout << scientific << "position quanta " << setprecision(2) << compact.compact.getQuantum(0) << " "
+			<< compact.compact.getQuantum(1) << " " << compact.compact.getQuantum(2) << endl << endl;
+	}
+	{
+		// a second pack of faster particles widens the velocities of the first rather than clamping either
+		cout << "velocity range" << endl;
+		cout << setw(10) << "spread" << setw(12) << "quantum" << setw(12) << "max error" << setw(10) << "in bound" << endl;
+		CompactStore cs;
+		ParticleStore all;
+		float spreads[] = { 0.2f, 6.0f };
+		for (int k = 0; k < 2; k++) {
+			float pos[3] = { 0, 0, 0 };
+			size_t first = all.count();
+			all.addBatch(pos, spreads[k], 1, (int)first, 10000, true, 7);
+			cs.append(all, first, all.count());
+			ParticleStore back;
+			cs.unpack(back);
+			double maxError = 0;
+			for (size_t i = 0; i < back.count(); i++) {
+				maxError = max(maxError, (double)max(fabs(back.dx[i] - all.dx[i]), fabs(back.dz[i] - all.dz[i])));
+			}
+			bool inBound = maxError <= cs.getVelocityQuantum(); // half a quantum each rounding, the first pack rounded twice
+			cout << setw(10) << fixed << setprecision(1) << spreads[k] << setw(12) << scientific << setprecision(2)
+				<< cs.getVelocityQuantum() << setw(12) << maxError << setw(10) << check(inBound) << endl;
+		}
+		cout << endl;
+	}
+	const int n = 10000000, steps = 20;
+	cout << n << " particles" << endl;
+	cout << setw(10) << "record" << setw(14) << "ms/step" << setw(16) << "ns/particle" << setw(14) << "memory MB"
+		<< setw(14) << "bytes/part" << endl;
+	for (int c = 0; c < 2; c++) {
+		malloc_trim(0); // what the last run freed leaves the process
+		double before = residentBytes();
+		double time, memory;
+		{
+			Simulation sim;
+			scatterOverPyramid(sim, n, c == 1);
+			sim.step(); // first touch of the step's scratch space
+			memory = residentBytes() - before;
+			double t = now();
+			for (int s = 0; s < steps; s++) { sim.step(); }
+			time = (now() - t) / steps;
+		}
+		cout << setw(10) << (c ? "compact" : "full") << setw(14) << fixed << setprecision(1) << time
+			<< setw(16) << setprecision(2) << time * 1e6 / n << setw(14) << setprecision(0) << memory / 1048576
+			<< setw(14) << setprecision(1) << memory / n << endl;
+	}
+}
+
+/**
+ * Lazy removal benchmark
+ * fires 1000 particles a step at random speeds onto the default pyramid
+ * and compacts the record whenever any particle has died, then only
+ * once an eighth or a half of it is dead. reports the dead carried per
+ * step, how many steps compacted, the time spent removing and the whole
+ * step time, and checks every run ends with the same particles and
+ * that find() returns the slot of each
+ */
+void benchLazy() {
+	const int rate = 1000, warm = 300, steps = 300;
+	const double fractions[3] = { 0, 0.125, 0.5 };
+	cout << setw(12) << "dead share" << setw(12) << "particles" << setw(10) << "dead" << setw(14) << "compactions"
+		<< setw(12) << "remove ms" << setw(10) << "step ms" << setw(8) << "same" << setw(8) << "found" << endl;
+	Simulation runs[3];
+	for (int r = 0; r < 3; r++) {
+		Simulation &sim = runs[r];
+		sim.randSpeed = true;
+		sim.deadFraction = fractions[r];
+		sim.emitters.push_back(Emitter(sim.firePosition, rate, sim.spreadRandomness, true));
+		for (int s = 0; s < warm; s++) {
+			sim.emit();
+			sim.step();
+		}
+		Profiler::Stats before = Profiler::get().stats();
+		double t = now(), carried = 0;
+		for (int s = 0; s < steps; s++) {
+			sim.emit();
+			sim.step();
+			carried += sim.particles.dead;
+		}
+		double time = (now() - t) / steps;
+		Profiler::Stats d = Profiler::get().stats().since(before);
+		ParticleStore &ps = sim.particles;
+		size_t alive = ps.alive();
+		ps.removeDead();
+		bool found = (ps.find(1) == -1); // the first particle fired is long gone
+		for (size_t i = 0; i < ps.count(); i++) { found = found && ps.find(ps.id[i]) == (long)i; }
+		cout << setw(12) << fixed << setprecision(3) << fractions[r] << setw(12) << alive << setw(10) << setprecision(0)
+			<< carried / steps << setw(14) << d.phaseCalls[Profiler::Remove] << setw(12) << setprecision(3)
+			<< d.phaseNs[Profiler::Remove] / 1e6 / steps << setw(10) << time
+			<< setw(8) << check(sameById(runs[0].particles, ps)) << setw(8) << check(found) << endl;
+	}
+}
+
+/**
+ * Main Driver
+ */
+int main(int argc, char** argv) {
+	for (double i = -5.0, j = 5.0, k = 5; k != 0; i -= 2.5, j += 5, k--) {
+		listFloors.push_back(Floor(i, j)); // default pyramid for the list step
+	}
+	const char *mode = (argc > 1) ? argv[1] : "store";
+	if (strcmp(mode, "store") == 0) { benchStore(); }
+	else if (strcmp(mode, "grid") == 0) { benchGrid(); }
+	else if (strcmp(mode, "threads") == 0) { benchThreads(); }
+	else if (strcmp(mode, "simd") == 0) { benchSimd(); }
+	else if (strcmp(mode, "trails") == 0) { benchTrails(); }
+	else if (strcmp(mode, "loop") == 0) { benchLoop(); }
+	else if (strcmp(mode, "scene") == 0) { benchScene(); }
+	else if (strcmp(mode, "record") == 0) { benchRecord(); }
+	else if (strcmp(mode, "alloc") == 0) { benchAlloc(); }
+	else if (strcmp(mode, "spawn") == 0) { benchSpawn(); }
+	else if (strcmp(mode, "floors") == 0) { benchFloors(); }
+	else if (strcmp(mode, "sleep") == 0) { benchSleep(); }
+	else if (strcmp(mode, "cull") == 0) { benchCull(); }
+	else if (strcmp(mode, "flags") == 0) { benchFlags(); }
+	else if (strcmp(mode, "contacts") == 0) { benchContacts(); }
+	else if (strcmp(mode, "compact") == 0) { benchCompact(); }
+	else if (strcmp(mode, "lazy") == 0) { benchLazy(); }
+	else {
+		cout << "usage: " << argv[0] << " [store|grid|threads|simd|trails|loop|scene|record|alloc|spawn|floors|sleep|cull|flags|contacts|compact|lazy]" << endl;
+		return 1;
+	}
+	return checkFailed ? 2 : 0;
+}
\ No newline at end of file
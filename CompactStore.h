@@ -0,0 +1,398 @@
+#pragma once
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "ParticleStore.h"
+#include "FloorIndex.h"
+#include "StepKernel.h"
+
+/**
+ * CompactStore Class
+ * the particle record quantized for runs of many millions, 27 bytes a
+ * particle against ParticleStore's 64. per particle:
+ *   x, y, z - 32 bit fixed point across a bounds box set when packing.
+ *     a 16 bit position would lose the same fraction of a quantum to
+ *     rounding every step a particle moves by the same amount, a drift
+ *     of a third of a quantum a step, so positions keep float precision
+ *   dx, dz - 16 bit, in 1/32768ths of a unit per step. packing a
+ *     particle faster than 32767 of those doubles the quantum until it
+ *     fits, rather than clamping it, so the range is always the record's
+ *     fastest particle and the rounding error half a quantum a step
+ *   speed - 32 bit, in 1/10000ths of a unit per step. spawn speeds and
+ *     bounces are already rounded to that, so with a gravity that is too
+ *     the speed is exact
+ *   size - 8 bit, in 1/64ths of a unit
+ *   life - 8 bit, a live particle has 1 to 100
+ *   state - colour in 2 bits, collision debounce in 3, path divisor in 1
+ *   id - 32 bit
+ * there is no dy, which is always zero, and no trails. the step decodes
+ * a batch of particles at a time, runs the full-precision step's
+ * arithmetic on it, with the full record's vector floor kernel, and
+ * encodes it again, so what is lost is one rounding of each position
+ * per step. with AVX-512 the decoding and encoding are vectorized too and
+ * a step costs about what the full record's does, without it several
+ * times that. positions outside the box are clamped to it: the box reaches
+ * 10 units past the floors, the spawn points and the kill plane, so a
+ * clamped particle is one that has already missed every floor. a
+ * nonzero speed never rounds to zero, as a zero speed means at rest
+ */
+
+class CompactStore {
+public:
+	enum {
+		velocityScale = 32768, // dx and dz quanta per unit, before any widening
+		maxVelocityShift = 24, // widest velocity quantum, 512 units a step
+		speedScale = 10000, // speed quanta per unit
+		sizeScale = 64 // size quanta per unit
+	};
+	std::vector<uint32_t> x, y, z;
+	std::vector<int16_t> dx, dz;
+	std::vector<int32_t> speed;
+	std::vector<uint8_t> size, life, state;
+	std::vector<int> id;
+	// a batch of the record decoded for the floor kernel, one per thread
+	struct Batch {
+		ParticleStore lanes; // x, y, z, size and speed of the batch
+		std::vector<float> hit; // floor each one hit, 0 if none
+	};
+	enum { batchSize = 512 }; // particles decoded at a time, 12 kB of lanes that stay in cache
+private:
+	double lo[3], quantum[3], perUnit[3]; // a coordinate q decodes to lo + q * quantum
+	int velocityShift; // dx and dz quanta are 2^velocityShift / velocityScale units
+
+	static uint8_t packState(int color, int buffer, int divisor) {
+		return (uint8_t)(color | (buffer << 2) | (divisor << 5));
+	}
+	// fixed point of v on an axis, rounded to nearest or up, clamped to the box
+	// truncating casts rather than floor and ceil, which are calls on plain x86-64
+	uint32_t encode(int a, float v, bool up = false) const {
+		double q = std::min(std::max((v - lo[a]) * perUnit[a], 0.0), 4294967295.0);
+		uint32_t e = (uint32_t)(up ? q : q + 0.5);
+		if (up) {
+			if (e < q) { e++; }
+			while (e < 4294967295u && decode(a, e) < v) { e++; } // up means the decoded value is not below v
+		}
+		return e;
+	}
+	float decode(int a, uint32_t q) const {
+		return (float)(lo[a] + q * quantum[a]);
+	}
+	// a move in quanta, halves away from zero. copysign keeps it free of a branch on the sign.
+	// these helpers are always inlined, as the vectorized move is built with other options and gcc would call them
+	__attribute__((always_inline)) static int64_t roundQuanta(double d) {
+		return (int64_t)(d + copysign(0.5, d));
+	}
+	__attribute__((always_inline)) static int64_t clampQuanta(int64_t q) {
+		return std::min(std::max(q, (int64_t)0), (int64_t)4294967295u);
+	}
+	// largest |dx| or |dz| a record with a given velocity shift holds
+	static float velocityBound(int shift) {
+		return 32767.0f * (1 << shift) / velocityScale;
+	}
+	// a signed 16 bit velocity, never zero unless v is. widenVelocity has made room for v
+	int16_t encodeVelocity(float v) const {
+		float q = floorf(v * ((float)velocityScale / (1 << velocityShift)) + 0.5f);
+		if (q == 0 && v != 0) { q = (v > 0) ? 1.0f : -1.0f; }
+		return (int16_t)std::min(std::max(q, -32767.0f), 32767.0f);
+	}
+	/**
+	 * Velocity range function
+	 * doubles the velocity quantum until a velocity of m fits in 16 bits,
+	 * and rounds the velocities already in the record to the new quantum,
+	 * so no velocity saturates. those keep their sign and never round to
+	 * zero, but lose the bits dropped
+	 * @param m - largest |dx| or |dz| about to be packed
+	 */
+	void widenVelocity(float m) {
+		int shift = velocityShift;
+		while (shift < maxVelocityShift && m > velocityBound(shift)) { shift++; }
+		int d = shift - velocityShift;
+		if (d == 0) { return; }
+		std::vector<int16_t> *axes[2] = { &dx, &dz };
+		for (int a = 0; a < 2; a++) {
+			for (size_t i = 0; i < axes[a]->size(); i++) {
+				int q = (*axes[a])[i], r = (abs(q) + (1 << (d - 1))) >> d; // halves away from zero
+				(*axes[a])[i] = (int16_t)((q < 0) ? -std::max(r, 1) : (q > 0) ? std::max(r, 1) : 0);
+			}
+		}
+		velocityShift = shift;
+	}
+	// likewise the speed, whose zero means at rest
+	__attribute__((always_inline)) static int32_t encodeSpeed(float s) {
+		double q = std::min(std::max((double)s * speedScale, -2147483647.0), 2147483647.0);
+		q = copysign(std::max(fabs(q), 0.5 * (s != 0)), q); // a nonzero speed at least rounds to one quantum
+		return (int32_t)(q + copysign(0.5, q)); // halves away from zero
+	}
+	__attribute__((always_inline)) static float decodeSpeed(int32_t q) {
+		return (float)((double)q / speedScale);
+	}
+public:
+	CompactStore() {
+		velocityShift = 0;
+		float l[3] = { -64, -64, -64 }, h[3] = { 64, 64, 64 };
+		setBounds(l, h);
+	}
+	size_t count() const {
+		return x.size();
+	}
+	/**
+	 * Bounds function, only while empty
+	 * @param l - lowest corner of the box positions are kept in
+	 * @param h - highest corner
+	 */
+	void setBounds(const float l[3], const float h[3]) {
+		for (int a = 0; a < 3; a++) {
+			lo[a] = l[a];
+			quantum[a] = std::max(h[a] - l[a], 1e-3f) / 4294967295.0;
+			perUnit[a] = 1 / quantum[a];
+		}
+	}
+	// smallest step of a position along axis a
+	double getQuantum(int a) const {
+		return quantum[a];
+	}
+	// smallest step of dx and dz, 1/32768 until a faster particle is packed
+	double getVelocityQuantum() const {
+		return (double)(1 << velocityShift) / velocityScale;
+	}
+	void clear() {
+		x.clear(); y.clear(); z.clear();
+		dx.clear(); dz.clear(); speed.clear();
+		size.clear(); life.clear(); state.clear();
+		id.clear();
+		velocityShift = 0;
+	}
+	void reserve(size_t n) {
+		x.reserve(n); y.reserve(n); z.reserve(n);
+		dx.reserve(n); dz.reserve(n); speed.reserve(n);
+		size.reserve(n); life.reserve(n); state.reserve(n);
+		id.reserve(n);
+	}
+	/**
+	 * Packing function
+	 * appends particles [begin, end) of a full record, dead ones are dropped
+	 * @param ps - the record to pack from
+	 */
+	void append(const ParticleStore &ps, size_t begin, size_t end) {
+		float fastest = 0;
+		for (size_t i = begin; i < end; i++) {
+			if (ps.life[i] > 0) { fastest = std::max(fastest, std::max(fabsf(ps.dx[i]), fabsf(ps.dz[i]))); }
+		}
+		widenVelocity(fastest);
+		for (size_t i = begin; i < end; i++) {
+			if (ps.life[i] <= 0) { continue; }
+			x.push_back(encode(0, ps.x[i])); y.push_back(encode(1, ps.y[i])); z.push_back(encode(2, ps.z[i]));
+			dx.push_back(encodeVelocity(ps.dx[i])); dz.push_back(encodeVelocity(ps.dz[i]));
+			speed.push_back(encodeSpeed(ps.speed[i]));
+			size.push_back((uint8_t)std::min(std::max(floorf(ps.size[i] * sizeScale + 0.5f), 1.0f), 255.0f));
+			life.push_back((uint8_t)std::min(ps.life[i], 255));
+			state.push_back(packState(ps.color[i], ps.buffer[i], ps.lineDivisor[i]));
+			id.push_back(ps.id[i]);
+		}
+	}
+	/**
+	 * Unpacking function
+	 * appends every particle, decoded, to a full record with no trails.
+	 * all of them are awake
+	 * @param ps - the record to unpack into
+	 */
+	void unpack(ParticleStore &ps) const {
+		for (size_t i = 0; i < count(); i++) {
+			ps.x.push_back(decode(0, x[i])); ps.y.push_back(decode(1, y[i])); ps.z.push_back(decode(2, z[i]));
+			ps.dx.push_back((float)(dx[i] * getVelocityQuantum())); ps.dy.push_back(0);
+			ps.dz.push_back((float)(dz[i] * getVelocityQuantum()));
+			ps.speed.push_back(decodeSpeed(speed[i]));
+			ps.size.push_back((float)size[i] / sizeScale);
+			ps.life.push_back(life[i]);
+			ps.color.push_back(state[i] & 3);
+			ps.buffer.push_back((state[i] >> 2) & 7);
+			ps.lineDivisor.push_back(state[i] >> 5);
+			ps.id.push_back(id[i]);
+			ps.trailSlot.push_back(-1); ps.trailHead.push_back(0); ps.trailLength.push_back(0);
+		}
+		ps.wakeAll();
+		ps.reshuffles++;
+	}
+	/**
+	 * Step function for a range of the record
+	 * works through the range a batch at a time. each particle of a batch
+	 * is decoded and moved, then the batch goes through the same vector
+	 * floor kernel as the full record, then each particle does the colour,
+	 * life and path divisor bookkeeping with the full-precision step's
+	 * arithmetic and is encoded again. only the particle's own slot is
+	 * written
+	 * @param g - gravity
+	 * @param f - friction
+	 * @param fi - the floors, compiled
+	 * @param kernel - the floor kernel
+	 * @param floors - whether there are floors, as numFloors != 0
+	 * @param rp - whether particles at rest lose life
+	 * @param b - this thread's batch
+	 * @return particles that hit a floor
+	 */
+	size_t step(size_t begin, size_t end, double g, double f, const FloorIndex &fi, const StepKernel &kernel,
+		bool floors, bool rp, Batch &b) {
+		size_t bounces = 0;
+		if (b.hit.size() < batchSize) {
+			ParticleStore &ls = b.lanes;
+			ls.x.resize(batchSize); ls.y.resize(batchSize); ls.z.resize(batchSize);
+			ls.size.resize(batchSize); ls.speed.resize(batchSize);
+			b.hit.resize(batchSize);
+		}
+		for (size_t first = begin; first < end; first += batchSize) {
+			size_t n = std::min((size_t)batchSize, end - first);
+			move(first, n, g, b.lanes, kernel.getIsa());
+			if (floors) {
+				kernel.floors(b.lanes, 0, n, fi, f, b.hit.data());
+				bounces += land(first, n, g, fi.getKillPlane(), rp, b, kernel.getIsa());
+			}
+			else {
+				for (size_t k = 0; k < n; k++) { speed[first + k] = encodeSpeed(b.lanes.speed[k]); }
+			}
+		}
+		return bounces;
+	}
+	/**
+	 * Dead removal function
+	 * drops every particle whose life has run out, keeping the order
+	 * @return number removed
+	 */
+	size_t removeDead() {
+		size_t n = count(), w = 0;
+		for (size_t i = 0; i < n; i++) {
+			if (life[i] == 0) { continue; }
+			if (w != i) {
+				x[w] = x[i]; y[w] = y[i]; z[w] = z[i];
+				dx[w] = dx[i]; dz[w] = dz[i]; speed[w] = speed[i];
+				size[w] = size[i]; life[w] = life[i]; state[w] = state[i];
+				id[w] = id[i];
+			}
+			w++;
+		}
+		x.resize(w); y.resize(w); z.resize(w);
+		dx.resize(w); dz.resize(w); speed.resize(w);
+		size.resize(w); life.resize(w); state.resize(w);
+		id.resize(w);
+		return n - w;
+	}
+	// bytes the record takes per particle
+	static size_t bytesPerParticle() {
+		return 3 * sizeof(uint32_t) + 2 * sizeof(int16_t) + sizeof(int32_t) + 3 * sizeof(uint8_t) + sizeof(int);
+	}
+private:
+	/**
+	 * Batch movement function
+	 * moves n particles from first, as ParticleStore::move, by whole
+	 * quanta so nothing is lost to rounding, and decodes them into the
+	 * lanes the floor kernel reads. speeds are left in the lanes.
+	 * the loops have no branches, so where the cpu has the AVX-512 64 bit
+	 * conversions they are vectorized. a batch is never aliased, which
+	 * gcc cannot see through the inlining, hence ivdep
+	 */
+	void move(size_t first, size_t n, double g, ParticleStore &ls, StepKernel::Isa isa) {
+#ifdef STEP_KERNEL_X86
+		if (vectorLoops(isa)) { return moveAvx512(first, n, g, ls); }
+#endif
+		moveLoop(first, n, g, ls);
+	}
+#ifdef STEP_KERNEL_X86
+	// whether the loops below are run in their AVX-512 build, which needs more than the kernel's avx512f
+	static bool vectorLoops(StepKernel::Isa isa) {
+		return isa == StepKernel::Avx512 && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512bw")
+			&& __builtin_cpu_supports("avx512vl");
+	}
+#endif
+#ifdef STEP_KERNEL_X86
+	__attribute__((target("avx512f,avx512dq,avx512bw,avx512vl"), optimize("tree-vectorize", "vect-cost-model=dynamic")))
+	void moveAvx512(size_t first, size_t n, double g, ParticleStore &ls) {
+		moveLoop(first, n, g, ls);
+	}
+#endif
+	__attribute__((always_inline)) inline void moveLoop(size_t first, size_t n, double g, ParticleStore &ls) {
+		uint32_t *__restrict qx = x.data() + first, *__restrict qy = y.data() + first, *__restrict qz = z.data() + first;
+		const int32_t *__restrict qs = speed.data() + first;
+		uint8_t *__restrict st = state.data() + first;
+		const int16_t *__restrict vx = dx.data() + first, *__restrict vz = dz.data() + first;
+		const uint8_t *__restrict sz = size.data() + first;
+		float *__restrict lx = ls.x.data(), *__restrict ly = ls.y.data(), *__restrict lz = ls.z.data();
+		float *__restrict lsize = ls.size.data(), *__restrict lspeed = ls.speed.data();
+		double xPerVelocity = perUnit[0] * getVelocityQuantum(), yPerUnit = perUnit[1],
+			zPerVelocity = perUnit[2] * getVelocityQuantum();
+		double x0 = lo[0], y0 = lo[1], z0 = lo[2], xq = quantum[0], yq = quantum[1], zq = quantum[2];
+#pragma GCC ivdep
+		for (size_t k = 0; k < n; k++) {
+			float s = decodeSpeed(qs[k]);
+			double m = (s != 0); // a particle at rest moves by nothing, a multiply rather than a branch
+			s = (float)(s - g * m);
+			int64_t ix = clampQuanta(qx[k] + roundQuanta(vx[k] * (xPerVelocity * m)));
+			int64_t iy = clampQuanta(qy[k] + roundQuanta(s * (yPerUnit * m)));
+			int64_t iz = clampQuanta(qz[k] + roundQuanta(vz[k] * (zPerVelocity * m)));
+			qx[k] = (uint32_t)ix; qy[k] = (uint32_t)iy; qz[k] = (uint32_t)iz;
+			lx[k] = (float)(x0 + ix * xq); ly[k] = (float)(y0 + iy * yq); lz[k] = (float)(z0 + iz * zq);
+			lsize[k] = (float)sz[k] / sizeScale;
+			lspeed[k] = s;
+		}
+		for (size_t k = 0; k < n; k++) { // path divisor of those that moved, a loop of its own as it is bytes
+			int divisor = st[k] >> 5;
+			int next = (divisor > 0) ? divisor - 1 : ((lspeed[k] != 0) ? (int)ParticleStore::maxDivisor : 0);
+			st[k] = (uint8_t)((st[k] & 31) | (((qs[k] != 0) ? next : divisor) << 5));
+		}
+	}
+	/**
+	 * Batch bookkeeping function
+	 * after the floor kernel has bounced the batch, as ParticleStore::bounce,
+	 * does checkDead for the particles that hit a floor and checkOffPyramid
+	 * for all, and encodes them again. a bounced particle's height is
+	 * rounded up, off the floor
+	 * @param lf - the kill plane
+	 * @return particles that hit a floor
+	 */
+	size_t land(size_t first, size_t n, double g, float lf, bool rp, Batch &b, StepKernel::Isa isa) {
+		size_t bounces = 0;
+		for (size_t k = 0; k < n; k++) {
+			if (b.hit[k] != 0) {
+				bounces++;
+				y[first + k] = encode(1, b.lanes.y[k], true);
+			}
+		}
+#ifdef STEP_KERNEL_X86
+		if (vectorLoops(isa)) {
+			landAvx512(first, n, g, lf, rp, b);
+			return bounces;
+		}
+#endif
+		landLoop(first, n, g, lf, rp, b);
+		return bounces;
+	}
+#ifdef STEP_KERNEL_X86
+	__attribute__((target("avx512f,avx512dq,avx512bw,avx512vl"), optimize("tree-vectorize", "vect-cost-model=dynamic")))
+	void landAvx512(size_t first, size_t n, double g, float lf, bool rp, Batch &b) {
+		landLoop(first, n, g, lf, rp, b);
+	}
+#endif
+	// the bookkeeping with its tests as masks, so it is vectorized as the move is
+	__attribute__((always_inline)) inline void landLoop(size_t first, size_t n, double g, float lf, bool rp, Batch &b) {
+		int32_t *__restrict qs = speed.data() + first;
+		uint8_t *__restrict lv = life.data() + first, *__restrict st = state.data() + first;
+		const float *__restrict ly = b.lanes.y.data(), *__restrict lspeed = b.lanes.speed.data(), *__restrict hit = b.hit.data();
+		int removing = rp;
+#pragma GCC ivdep
+		for (size_t k = 0; k < n; k++) {
+			float s = lspeed[k], py = ly[k];
+			int c = st[k] & 3, l = lv[k];
+			int bounced = (hit[k] != 0); // checkDead, for those that hit a floor
+			int dying = (l < 100), settled = !dying & (s <= (g - 0.01)) & (s != 0); // non-100 life is stationary
+			l -= bounced & dying;
+			s *= (float)(1 - (bounced & settled)); // to rest, a zero of either sign encodes as 0
+			c += bounced & (c == 0); // yellow on its first bounce
+			c += bounced & (dying | settled) & (c == 1); // magenta once dead
+			int below = (py < lf), off = (s == 0) | below; // checkOffPyramid
+			c += off * (2 - c);
+			l -= off & (removing | below);
+			qs[k] = encodeSpeed(s);
+			lv[k] = (uint8_t)std::max(l, 0);
+			st[k] = (uint8_t)((st[k] & ~3) | c);
+		}
+	}
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+/**
+ * CubeFaces Class
+ * the six faces of the cube from -1 to 1 on every axis, as glutSolidCube(2)
+ * draws it, with 4 corners per face so each has a flat normal. the
+ * particle and floor meshes both build their boxes from it, scaled to size
+ */
+
+class CubeFaces {
+public:
+	enum { faces = 6, corners = 4 };
+	/**
+	 * Corner function
+	 * corners of a face run counter-clockwise seen from outside, so two
+	 * triangles 0 1 2 and 0 2 3 cover it
+	 * @param f - face, 0 to 5: +x, -x, +y, -y, +z, -z
+	 * @param c - corner, 0 to 3
+	 * @param p - position of the corner
+	 * @param n - normal of the face
+	 */
+	static void corner(int f, int c, float p[3], float n[3]) {
+		float u[3] = { 0, 0, 0 }, v[3];
+		n[0] = n[1] = n[2] = 0;
+		n[f / 2] = (f % 2) ? -1.0f : 1.0f;
+		u[(f / 2 + 1) % 3] = 1; // u and v = n x u span the face
+		v[0] = n[1] * u[2] - n[2] * u[1]; v[1] = n[2] * u[0] - n[0] * u[2]; v[2] = n[0] * u[1] - n[1] * u[0];
+		float a = (c == 1 || c == 2) ? 1.0f : -1.0f, b = (c >= 2) ? 1.0f : -1.0f;
+		for (int k = 0; k < 3; k++) { p[k] = n[k] + u[k] * a + v[k] * b; }
+	}
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+/**
+ * Emitter Class
+ * a particle source like the cannon, with its own position, stream and
+ * firing pattern. every step it fires rate particles, and every
+ * burstEvery steps burst more on top, as one batch appended to the
+ * record in a single pass
+ */
+
+class Emitter {
+public:
+	float position[3];
+	int rate; // particles per step
+	int burst; // extra particles fired on a burst step
+	int burstEvery; // steps between bursts, 0 for none
+	double spread; // randomness of stream
+	bool randSpeed; // random velocity of particle?
+
+	/**
+	 * Emitter Constructor
+	 * @param p - position to fire from
+	 * @param r - particles per step
+	 * @param sr - spread randomness
+	 * @param rs - randomness toggle for speed
+	 */
+	Emitter(const float p[3], int r, double sr, bool rs) {
+		position[0] = p[0]; position[1] = p[1]; position[2] = p[2];
+		rate = r;
+		burst = 0; burstEvery = 0;
+		spread = sr;
+		randSpeed = rs;
+	}
+	// fires n extra particles every k steps, starting on the first
+	void setBurst(int n, int k) {
+		burst = n;
+		burstEvery = k;
+	}
+	// particles to fire on a given step
+	int batchSize(long step) const {
+		return rate + ((burstEvery > 0 && step % burstEvery == 0) ? burst : 0);
+	}
+};
@@ -14,10 +14,10 @@ public:
 		position = p;
 		size = s;
 	}
-	float getPos() {
+	float getPos() const {
 		return position;
 	}
-	float getSize() {
+	float getSize() const {
 		return size;
 	}
 };
\ No newline at end of file
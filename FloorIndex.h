@@ -0,0 +1,167 @@
+#pragma once
+#include <math.h>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include "Floor.h"
+
+/**
+ * FloorIndex Class
+ * the floors compiled for collision lookups. a particle hits the first
+ * floor, in list order, that is above its bottom and whose square it is
+ * over, so the test only needs the particle's height and m, the larger
+ * of |x| and |z|. three layouts are told apart when the floors change:
+ * Pyramid - the floors addFloor builds, y = -5 - 2.5k and half-width
+ *   5 + 5k, the only floor a particle can hit is worked out from m, O(1)
+ * Nested - any stack that widens as it goes down, the first floor wide
+ *   enough is the only candidate and is binary searched, O(log F)
+ * Slabs - anything else, floors are sorted by width so the ones wide
+ *   enough are a suffix found by binary search, that suffix is kept in
+ *   list order and scanned for the first floor above the particle.
+ * every comparison is the one the linear scan made, so the floor found
+ * is the same bit for bit. the kill plane is kept here too
+ */
+
+class FloorIndex {
+public:
+	enum Layout { Empty, Pyramid, Nested, Slabs };
+private:
+	std::vector<float> pos, size; // floors in list order
+	std::vector<float> sortedSize; // half-widths, narrowest first
+	std::vector<int> suffixOrder; // row j: floors of sortedSize[j..], in list order
+	Layout layout;
+	float killPlane; // floor particles are removed below
+	bool built; // false until the first build
+	unsigned int generation; // bumped by every rebuild
+
+	// whether x and z are over floor k, as the scan compared them
+	bool over(int k, float m, float r) const {
+		return m < size[k] + r;
+	}
+	// first floor in list order that x and z are over, for nested layouts
+	int firstOver(float m, float r) const {
+		int n = (int)pos.size(), k;
+		if (layout == Pyramid) { // invert half-width = 5 + 5k, then settle any rounding
+			float guess = (m - r - 5) / 5;
+			k = (guess < 0) ? 0 : (guess >= n) ? n : (int)guess;
+			while (k > 0 && over(k - 1, m, r)) { k--; }
+			while (k < n && !over(k, m, r)) { k++; }
+			return k;
+		}
+		int lo = 0, hi = n;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (over(mid, m, r)) { hi = mid; }
+			else { lo = mid + 1; }
+		}
+		return lo;
+	}
+public:
+	FloorIndex() {
+		layout = Empty;
+		killPlane = 0;
+		built = false;
+		generation = 0;
+	}
+	// whether the index was built from these floors
+	bool matches(const std::list<Floor> &floors) const {
+		bool same = built && (floors.size() == pos.size());
+		int k = 0;
+		for (std::list<Floor>::const_iterator f = floors.begin(); same && f != floors.end(); ++f, k++) {
+			same = (f->getPos() == pos[k] && f->getSize() == size[k]);
+		}
+		return same;
+	}
+	/**
+	 * Compile function
+	 * rebuilds the index if the floors differ from the last build
+	 * @return true if it was rebuilt
+	 */
+	bool build(const std::list<Floor> &floors) {
+		if (matches(floors)) { return false; }
+		built = true;
+		generation++;
+		int k;
+		pos.clear(); size.clear();
+		for (std::list<Floor>::const_iterator f = floors.begin(); f != floors.end(); ++f) {
+			pos.push_back(f->getPos());
+			size.push_back(f->getSize());
+		}
+		int n = (int)pos.size();
+		killPlane = (n > 0) ? pos.back() : 0;
+		bool nested = true, pyramid = true;
+		for (k = 0; k < n; k++) {
+			if (k > 0 && (size[k] < size[k - 1] || pos[k] > pos[k - 1])) { nested = false; }
+			if (pos[k] != (float)(-5.0 - 2.5 * k) || size[k] != (float)(5.0 + 5.0 * k)) { pyramid = false; }
+		}
+		layout = (n == 0) ? Empty : pyramid ? Pyramid : nested ? Nested : Slabs;
+		// slab fallback, built for any layout so it can be checked against
+		std::vector<int> bySize(n);
+		for (k = 0; k < n; k++) { bySize[k] = k; }
+		std::stable_sort(bySize.begin(), bySize.end(), [&](int a, int b) { return size[a] < size[b]; });
+		sortedSize.resize(n);
+		suffixOrder.assign((size_t)n * n, -1);
+		for (int j = 0; j < n; j++) {
+			sortedSize[j] = size[bySize[j]];
+			std::vector<int> row(bySize.begin() + j, bySize.end());
+			std::sort(row.begin(), row.end());
+			std::copy(row.begin(), row.end(), suffixOrder.begin() + (size_t)j * n);
+		}
+		return true;
+	}
+	unsigned int getGeneration() const {
+		return generation;
+	}
+	Layout getLayout() const {
+		return layout;
+	}
+	static const char *name(Layout l) {
+		switch (l) {
+			case Pyramid: return "pyramid";
+			case Nested: return "nested";
+			case Slabs: return "slabs";
+			default: return "empty";
+		}
+	}
+	int count() const {
+		return (int)pos.size();
+	}
+	const float *positions() const {
+		return pos.data();
+	}
+	const float *sizes() const {
+		return size.data();
+	}
+	// position of the last floor in the list, 0 with no floors
+	float getKillPlane() const {
+		return killPlane;
+	}
+	/**
+	 * First hit function
+	 * @param r - collision radius, 5 times the particle size
+	 * @return index of the first floor the particle is on, -1 if none
+	 */
+	int firstHit(float x, float y, float z, float r) const {
+		float m = std::max(fabsf(x), fabsf(z));
+		if (layout == Pyramid || layout == Nested) {
+			// floors below the first one it is over are wider but lower
+			int k = firstOver(m, r);
+			return (k < count() && y < pos[k] + r) ? k : -1;
+		}
+		return firstHitSlabs(m, y, r);
+	}
+	// the general lookup, valid for every layout
+	int firstHitSlabs(float m, float y, float r) const {
+		int n = count(), lo = 0, hi = n;
+		while (lo < hi) { // narrowest floor it is over, wider ones are too
+			int mid = (lo + hi) / 2;
+			if (m < sortedSize[mid] + r) { hi = mid; }
+			else { lo = mid + 1; }
+		}
+		const int *row = (lo < n) ? &suffixOrder[(size_t)lo * n] : 0;
+		for (int j = 0; j < n - lo; j++) {
+			if (y < pos[row[j]] + r) { return row[j]; }
+		}
+		return -1;
+	}
+};
@@ -0,0 +1,85 @@
+#pragma once
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <stddef.h>
+#include <vector>
+#include "Floor.h"
+#include "CubeFaces.h"
+
+/**
+ * FloorMesh Class
+ * the floors as one static vertex buffer. each floor is the box
+ * glutSolidCube(2) scaled to its half-width and a tenth high, purple
+ * with the alpha fading towards the top floor, and the whole stack is one
+ * draw call. the buffer is only rebuilt when the floors change
+ */
+
+class FloorMesh {
+private:
+	struct Vertex {
+		GLfloat position[3];
+		GLfloat normal[3];
+		GLubyte color[4];
+	};
+	std::vector<float> pos, size; // floors the buffer holds
+	std::vector<Vertex> vertices; // staging for a rebuild
+	GLuint buffer;
+	bool built;
+
+	bool matches(const std::vector<Floor> &floors) const {
+		if (!built || floors.size() != pos.size()) { return false; }
+		for (size_t k = 0; k < floors.size(); k++) {
+			if (floors[k].getPos() != pos[k] || floors[k].getSize() != size[k]) { return false; }
+		}
+		return true;
+	}
+	// uploads the six faces of every floor, in list order as they are blended
+	void build(const std::vector<Floor> &floors) {
+		pos.clear(); size.clear(); vertices.clear();
+		int i = (int)floors.size() - 1;
+		for (size_t k = 0; k < floors.size(); k++) {
+			float y = floors[k].getPos(), s = floors[k].getSize();
+			pos.push_back(y); size.push_back(s);
+			double blend = 255 - ((double)(i--) / (double)(floors.size())) * 255; // top floor faintest
+			for (int f = 0; f < CubeFaces::faces; f++) {
+				for (int c = 0; c < CubeFaces::corners; c++) {
+					float p[3], n[3];
+					CubeFaces::corner(f, c, p, n);
+					Vertex vx = { { p[0] * s, y + p[1] * 0.1f, p[2] * s }, { n[0], n[1], n[2] },
+						{ 186, 126, 207, (GLubyte)blend } };
+					vertices.push_back(vx);
+				}
+			}
+		}
+		if (!buffer) { glGenBuffers(1, &buffer); }
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+		built = true;
+	}
+public:
+	FloorMesh() : buffer(0), built(false) {}
+	/**
+	 * Floor drawing function, needs a current GL context
+	 * @param floors - the floors, top first
+	 */
+	void draw(const std::vector<Floor> &floors) {
+		if (!matches(floors)) { build(floors); }
+		else { glBindBuffer(GL_ARRAY_BUFFER, buffer); }
+		if (floors.empty()) {
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			return;
+		}
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glVertexPointer(3, GL_FLOAT, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, position));
+		glNormalPointer(GL_FLOAT, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, normal));
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, color));
+		glDrawArrays(GL_QUADS, 0, (GLsizei)(floors.size() * 24));
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_NORMAL_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+		glBindBuffer(GL_ARRAY_BUFFER, 0); // particles draw from client memory
+	}
+};
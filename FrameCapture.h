@@ -0,0 +1,234 @@
+#pragma once
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * FrameCapture Class
+ * reads rendered frames back and streams them out as rgb24 images.
+ * capture() only queues a glReadPixels into one of a ring of pixel
+ * buffer objects and maps the one queued ring - 1 frames earlier, which
+ * the GL has long finished, so the render thread never waits on the
+ * readback. the mapped frame is copied top row first into the frame
+ * being filled and swapped over to the I/O thread, which writes it to
+ *   pattern%05d.ppm - one binary PPM per frame, numbered from 0. the
+ *     pattern holds exactly one %d, with an optional 0 flag and width,
+ *     and %% for a percent sign. it is split around the %d when opened
+ *     and never used as a format
+ *   |command - raw frames piped to a command, e.g. an ffmpeg encode
+ *   anything else - raw frames appended to one file
+ * the render thread only waits if the I/O thread falls a whole frame
+ * behind, which is counted as a stall
+ */
+
+class FrameCapture {
+public:
+	enum { ring = 3 }; // pixel buffers in flight
+	FrameCapture() : width(0), height(0), file(0), piped(false), sequence(false), zeroPad(false), digits(0),
+		issued(0), written(0), stalls(0), unmapped(0), failed(false), pending(false), stopping(false) {
+		memset(pbo, 0, sizeof(pbo));
+	}
+	~FrameCapture() {
+		close();
+	}
+	/**
+	 * Capture opening function, needs a current GL context
+	 * @param dest - image pattern, |command or raw file, as above
+	 * @param w - width of the frames in pixels
+	 * @param h - height of the frames in pixels
+	 * @return false if the file or pipe could not be opened, or a pattern
+	 * does not hold exactly one %d
+	 */
+	bool open(const char *dest, int w, int h) {
+		close();
+		width = w; height = h;
+		piped = (dest[0] == '|');
+		sequence = !piped && strchr(dest, '%');
+		if (sequence && !splitPattern(dest)) { return false; }
+		if (piped) {
+			signal(SIGPIPE, SIG_IGN); // a command that quits is a write error, not a crash
+			file = popen(dest + 1, "w");
+		}
+		else if (!sequence) { file = fopen(dest, "wb"); }
+		if (!sequence && !file) { return false; }
+		issued = 0; written = 0; stalls = 0; unmapped = 0;
+		failed = false; pending = false; stopping = false;
+		glGenBuffers(ring, pbo);
+		for (int b = 0; b < ring; b++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[b]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes(), 0, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		filling.resize(frameBytes());
+		writing.resize(frameBytes());
+		io = std::thread(&FrameCapture::ioLoop, this);
+		return true;
+	}
+	bool isOpen() const {
+		return pbo[0] != 0;
+	}
+	int getWidth() const {
+		return width;
+	}
+	int getHeight() const {
+		return height;
+	}
+	// frames captured so far
+	long getFrames() const {
+		return issued;
+	}
+	// times capture() had to wait for the I/O thread
+	long getStalls() const {
+		return stalls;
+	}
+	/**
+	 * Frame capture function
+	 * queues the readback of the bound read framebuffer, call it once
+	 * the frame is drawn and before the buffers are swapped
+	 */
+	void capture() {
+		if (!isOpen()) { return; }
+		glPixelStorei(GL_PACK_ALIGNMENT, 1); // rgb rows are not padded
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[issued % ring]);
+		glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		issued++;
+		if (issued - written >= ring) { collect(); } // oldest readback, queued ring - 1 frames ago
+	}
+	/**
+	 * Capture closing function
+	 * writes the frames still in flight and waits for the I/O thread,
+	 * needs the GL context that opened it
+	 * @return false if any frame failed to write
+	 */
+	bool close() {
+		if (!isOpen()) { return true; }
+		while (written < issued) { collect(); }
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_one();
+		io.join();
+		glDeleteBuffers(ring, pbo);
+		memset(pbo, 0, sizeof(pbo));
+		if (file && (piped ? pclose(file) : fclose(file)) != 0) { failed = true; }
+		file = 0;
+		return !failed && unmapped == 0;
+	}
+private:
+	int width, height;
+	FILE *file; // the stream, if not an image sequence
+	bool piped;
+	bool sequence; // one image file per frame rather than a stream
+	std::string prefix, suffix; // image file names, around the frame number
+	bool zeroPad; // frame number padded with zeros rather than spaces
+	int digits; // least digits of the frame number
+	GLuint pbo[ring];
+	long issued, written; // frames read back, frames handed to the I/O thread
+	long stalls;
+	long unmapped; // readbacks that could not be mapped, the last frame goes out again
+	bool failed; // only set by the I/O thread until it stops
+	std::vector<unsigned char> filling, writing; // frame being copied out, frame being written
+	long writingFrame;
+	std::thread io;
+	std::mutex lock;
+	std::condition_variable wake, done;
+	bool pending; // writing holds a frame the I/O thread has not finished
+	bool stopping;
+
+	/**
+	 * Pattern splitting function
+	 * keeps the text either side of a pattern's one integer conversion
+	 * @param dest - image pattern
+	 * @return false if it has no %d, more than one, or any other conversion
+	 */
+	bool splitPattern(const char *dest) {
+		std::string text[2];
+		int part = 0;
+		for (const char *c = dest; *c; c++) {
+			if (*c != '%') {
+				text[part] += *c;
+				continue;
+			}
+			if (*++c == '%') {
+				text[part] += '%';
+				continue;
+			}
+			if (part == 1) { return false; }
+			zeroPad = (*c == '0');
+			if (zeroPad) { c++; }
+			for (digits = 0; isdigit((unsigned char)*c) && digits < 100; c++) { digits = digits * 10 + (*c - '0'); }
+			if (*c != 'd' || digits > 64) { return false; }
+			part = 1;
+		}
+		prefix = text[0]; suffix = text[1];
+		return part == 1;
+	}
+	size_t frameBytes() const {
+		return (size_t)width * height * 3;
+	}
+	// maps the oldest readback, flips it into filling and hands it over
+	void collect() {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[written % ring]);
+		const unsigned char *pixels = (const unsigned char*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+		if (pixels) {
+			size_t row = (size_t)width * 3;
+			for (int y = 0; y < height; y++) { // GL rows start at the bottom
+				memcpy(&filling[y * row], pixels + (height - 1 - y) * row, row);
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		else { unmapped++; }
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			if (pending) { stalls++; }
+			while (pending) { done.wait(guard); }
+			filling.swap(writing);
+			writingFrame = written;
+			pending = true;
+		}
+		wake.notify_one();
+		written++;
+	}
+	// writes one frame, on the I/O thread
+	void writeFrame() {
+		if (sequence) {
+			char number[128];
+			snprintf(number, sizeof(number), zeroPad ? "%0*ld" : "%*ld", digits, writingFrame);
+			std::string path = prefix + number + suffix;
+			FILE *f = fopen(path.c_str(), "wb");
+			if (!f || fprintf(f, "P6\n%d %d\n255\n", width, height) < 0
+				|| fwrite(writing.data(), 1, writing.size(), f) != writing.size()) {
+				failed = true;
+			}
+			if (f && fclose(f) != 0) { failed = true; }
+			return;
+		}
+		if (fwrite(writing.data(), 1, writing.size(), file) != writing.size()) { failed = true; }
+	}
+	// body of the I/O thread
+	void ioLoop() {
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				while (!pending && !stopping) { wake.wait(guard); }
+				if (!pending) { return; } // stopping with nothing left
+			}
+			writeFrame();
+			std::lock_guard<std::mutex> guard(lock);
+			pending = false;
+			done.notify_one();
+		}
+	}
+};
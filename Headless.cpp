@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include "Simulation.h"
+#include "SceneFile.h"
+#include "TrajectoryFile.h"
+
+using namespace std;
+
+/**
+ * Headless Driver
+ * steps the simulation as fast as possible with no window,
+ * the scene is configured entirely from the command line
+ */
+
+/**
+ * Function which prints the command line options
+ */
+void printUsage(const char *name) {
+	cout << "usage: " << name << " [options]" << endl;
+	cout << "  --steps N      physics steps to run (default 1000)" << endl;
+	cout << "  --rate N       particles fired per step from the cannon (default 1)" << endl;
+	cout << "  --emitter X,Y,Z,RATE[,SPREAD]  fire RATE per step from X,Y,Z instead, repeatable" << endl;
+	cout << "  --burst N,K    the last emitter also fires N every K steps" << endl;
+	cout << "  --seed N       random seed (default 1)" << endl;
+	cout << "  --threads N    threads the step is split across (default 1)" << endl;
+	cout << "  --gravity G    gravity per step (default 0.1)" << endl;
+	cout << "  --friction F   friction per bounce (default 0.2)" << endl;
+	cout << "  --floors N     pyramid floors, 0 to 10 (default 5)" << endl;
+	cout << "  --size S       particle scale factor (default 0.25)" << endl;
+	cout << "  --spread S     spread randomness of the cannon (default 0.2)" << endl;
+	cout << "  --rand-speed   randomize initial particle speed" << endl;
+	cout << "  --bumping      enable interparticle collision" << endl;
+	cout << "  --immortal     keep particles that come to rest" << endl;
+	cout << "  --no-sleep     keep stepping particles that have come to rest" << endl;
+	cout << "  --trail N      record paths of N points per particle (default 0, off)" << endl;
+	cout << "  --compact      keep particles quantized in 27 bytes each, no bumping or paths;" << endl;
+	cout << "                 steps as fast as the full record with AVX-512, about 3x slower without" << endl;
+	cout << "  --load FILE    start from a saved scene, later options override it;" << endl;
+	cout << "                 its emitters keep firing unless --rate or --emitter is given" << endl;
+	cout << "  --save FILE    save the scene once every step has run" << endl;
+	cout << "  --record FILE  stream particles to a trajectory file" << endl;
+	cout << "  --record-every N  record every Nth step (default 1)" << endl;
+	cout << "  --compress     zlib compress the trajectory, needs -DUSE_ZLIB -lz" << endl;
+	cout << "  --profile      print phase times and counters at the end" << endl;
+	cout << "  --profile-csv FILE  write phase times and counters of every step" << endl;
+	cout << "  --trace FILE   write a Chrome trace (chrome://tracing) of every phase" << endl;
+}
+
+/**
+ * Main Driver
+ */
+int main(int argc, char** argv) {
+	Simulation sim;
+	long steps = 1000;
+	int rate = 1;
+	bool rateGiven = false;
+	const char *savePath = 0;
+	const char *recordPath = 0;
+	long recordEvery = 1;
+	bool compress = false;
+	bool compact = false;
+	bool profile = false;
+	const char *csvPath = 0, *tracePath = 0;
+	vector<Emitter> emitters;
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if (strcmp(arg, "--steps") == 0 && hasValue) { steps = atol(argv[++i]); }
+		else if (strcmp(arg, "--rate") == 0 && hasValue) {
+			rate = atoi(argv[++i]);
+			rateGiven = true;
+		}
+		else if (strcmp(arg, "--seed") == 0 && hasValue) { sim.seed(strtoull(argv[++i], 0, 10)); }
+		else if (strcmp(arg, "--emitter") == 0 && hasValue) {
+			float p[3];
+			int r;
+			double spread = -1; // the --spread of the run unless given
+			if (sscanf(argv[++i], "%f,%f,%f,%d,%lf", &p[0], &p[1], &p[2], &r, &spread) < 4) {
+				printUsage(argv[0]);
+				return 1;
+			}
+			emitters.push_back(Emitter(p, r, spread, false));
+		}
+		else if (strcmp(arg, "--burst") == 0 && hasValue && !emitters.empty()) {
+			int n, k;
+			if (sscanf(argv[++i], "%d,%d", &n, &k) != 2) {
+				printUsage(argv[0]);
+				return 1;
+			}
+			emitters.back().setBurst(n, k);
+		}
+		else if (strcmp(arg, "--threads") == 0 && hasValue) { sim.setThreads(atoi(argv[++i])); }
+		else if (strcmp(arg, "--gravity") == 0 && hasValue) { sim.gravity = atof(argv[++i]); }
+		else if (strcmp(arg, "--friction") == 0 && hasValue) { sim.friction = atof(argv[++i]); }
+		else if (strcmp(arg, "--floors") == 0 && hasValue) { sim.setFloors(atoi(argv[++i])); }
+		else if (strcmp(arg, "--size") == 0 && hasValue) { sim.scaleFactor = (float)atof(argv[++i]); }
+		else if (strcmp(arg, "--spread") == 0 && hasValue) { sim.spreadRandomness = atof(argv[++i]); }
+		else if (strcmp(arg, "--rand-speed") == 0) { sim.randSpeed = true; }
+		else if (strcmp(arg, "--bumping") == 0) { sim.particleBumping = true; }
+		else if (strcmp(arg, "--immortal") == 0) { sim.removeParticles = false; }
+		else if (strcmp(arg, "--no-sleep") == 0) { sim.sleeping = false; }
+		else if (strcmp(arg, "--compact") == 0) { compact = true; }
+		else if (strcmp(arg, "--trail") == 0 && hasValue) { sim.particles.setTrailCapacity(max(atoi(argv[++i]), 0)); }
+		else if (strcmp(arg, "--load") == 0 && hasValue) {
+			if (!SceneFile::load(sim, argv[++i])) {
+				cout << "could not load scene " << argv[i] << endl;
+				return 1;
+			}
+		}
+		else if (strcmp(arg, "--save") == 0 && hasValue) { savePath = argv[++i]; }
+		else if (strcmp(arg, "--record") == 0 && hasValue) { recordPath = argv[++i]; }
+		else if (strcmp(arg, "--record-every") == 0 && hasValue) { recordEvery = max(atol(argv[++i]), 1L); }
+		else if (strcmp(arg, "--compress") == 0) { compress = true; }
+		else if (strcmp(arg, "--profile") == 0) { profile = true; }
+		else if (strcmp(arg, "--profile-csv") == 0 && hasValue) { csvPath = argv[++i]; }
+		else if (strcmp(arg, "--trace") == 0 && hasValue) { tracePath = argv[++i]; }
+		else {
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	if (!emitters.empty() || rateGiven || sim.emitters.empty()) { // otherwise a loaded scene fires as it was saved
+		if (emitters.empty()) { emitters.push_back(Emitter(sim.firePosition, rate, sim.spreadRandomness, false)); }
+		for (size_t e = 0; e < emitters.size(); e++) {
+			if (emitters[e].spread < 0) { emitters[e].spread = sim.spreadRandomness; }
+			emitters[e].randSpeed = sim.randSpeed;
+		}
+		sim.emitters = emitters;
+	}
+	Profiler::get().setKeepRows(csvPath != 0);
+	Profiler::get().setTracing(tracePath != 0);
+	if (compact && recordPath) {
+		cout << "--record needs the full particle record, not --compact" << endl;
+		return 1;
+	}
+	if (!sim.setCompact(compact)) {
+		cout << (sim.particleBumping ? "--bumping" : "--trail") << " needs the full particle record, not --compact" << endl;
+		return 1;
+	}
+	TrajectoryWriter trajectory;
+	if (recordPath && !trajectory.open(recordPath, compress, 16)) {
+		cout << "could not create trajectory " << recordPath << endl;
+		return 1;
+	}
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	size_t peakParticles = 0;
+	for (long s = 0; s < steps; s++) {
+		sim.emit(); // constant fire
+		sim.step();
+		if ((s + 1) % recordEvery == 0) { trajectory.record(sim.particles, s + 1); } // step s + 1 is done
+		peakParticles = max(peakParticles, sim.liveCount());
+	}
+	sim.setCompact(false); // the report reads the full record
+	sim.particles.removeDead(); // and only the live particles
+	bool recorded = trajectory.close();
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "Steps: " << steps << endl;
+	cout << "Particles Fired: " << sim.particleCount << endl;
+	cout << "Particles Alive: " << sim.particles.alive() << endl;
+	cout << "Peak Particles: " << peakParticles << endl;
+	if (!compact) { cout << "Particles Asleep: " << sim.particles.sleeping() << endl; }
+	cout << "Elapsed Seconds: " << seconds << endl;
+	cout << "Steps per Second: " << ((seconds > 0) ? steps / seconds : 0) << endl;
+	cout << "State Checksum: " << hex << setw(16) << setfill('0') << sim.particles.checksum() << dec << endl;
+	if (recordPath) { cout << "Trajectory Stalls: " << trajectory.getStalls() << endl; }
+	if (!recorded) {
+		cout << "could not write trajectory " << recordPath << endl;
+		return 1;
+	}
+	if (profile) {
+		cout << flush;
+		Profiler::print(stdout, Profiler::get().stats());
+	}
+	if ((csvPath && !Profiler::get().writeCsv(csvPath)) || (tracePath && !Profiler::get().writeTrace(tracePath))) {
+		cout << "could not write profile" << endl;
+		return 1;
+	}
+	if (savePath && !SceneFile::save(sim, savePath)) {
+		cout << "could not save scene " << savePath << endl;
+		return 1;
+	}
+	return 0;
+}
\ No newline at end of file
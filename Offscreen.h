@@ -0,0 +1,96 @@
+#pragma once
+#define GL_GLEXT_PROTOTYPES
+#include <stdlib.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+/**
+ * OffscreenContext Class
+ * a desktop GL context with no window and no display server, for
+ * rendering on headless machines. Mesa's surfaceless EGL platform gives
+ * a context without any surface, which then draws into a framebuffer
+ * object of colour and depth renderbuffers. the software rasterizer is
+ * asked for unless LIBGL_ALWAYS_SOFTWARE is already set. needs building
+ * with -DUSE_EGL -lEGL
+ */
+
+class OffscreenContext {
+private:
+	EGLDisplay display;
+	EGLContext context;
+	GLuint framebuffer, color, depth;
+	const char *error; // step that failed
+
+	bool fail(const char *step) {
+		error = step;
+		destroy();
+		return false;
+	}
+public:
+	OffscreenContext() : display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT), framebuffer(0), color(0), depth(0),
+		error("not created") {}
+	~OffscreenContext() {
+		destroy();
+	}
+	/**
+	 * Context creation function
+	 * makes the context current with its framebuffer bound and the
+	 * viewport covering it
+	 * @param width - width of the framebuffer in pixels
+	 * @param height - height of the framebuffer in pixels
+	 * @return false if any step failed, getError() says which
+	 */
+	bool create(int width, int height) {
+		destroy();
+		setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0); // llvmpipe, even where there is a GPU
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (!getPlatformDisplay) { return fail("no eglGetPlatformDisplayEXT"); }
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, 0, 0)) { return fail("no surfaceless EGL display"); }
+		if (!eglBindAPI(EGL_OPENGL_API)) { return fail("no desktop GL through EGL"); }
+		// no config needed as nothing is ever drawn to a surface
+		context = eglCreateContext(display, (EGLConfig)0, EGL_NO_CONTEXT, 0);
+		if (context == EGL_NO_CONTEXT) { return fail("could not create a context"); }
+		if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) { return fail("could not make the context current"); }
+		glGenRenderbuffers(1, &color);
+		glBindRenderbuffer(GL_RENDERBUFFER, color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glGenRenderbuffers(1, &depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) { return fail("incomplete framebuffer"); }
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glViewport(0, 0, width, height);
+		return true;
+	}
+	// releases the framebuffer and the context
+	void destroy() {
+		if (context != EGL_NO_CONTEXT) {
+			if (framebuffer) { glDeleteFramebuffers(1, &framebuffer); }
+			if (color) { glDeleteRenderbuffers(1, &color); }
+			if (depth) { glDeleteRenderbuffers(1, &depth); }
+			framebuffer = color = depth = 0;
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			eglDestroyContext(display, context);
+			context = EGL_NO_CONTEXT;
+		}
+		if (display != EGL_NO_DISPLAY) {
+			eglTerminate(display);
+			display = EGL_NO_DISPLAY;
+		}
+	}
+	const char *getError() const {
+		return error;
+	}
+	// GL_RENDERER of the context, e.g. llvmpipe
+	const char *renderer() const {
+		return (const char*)glGetString(GL_RENDERER);
+	}
+};
@@ -0,0 +1,279 @@
+#pragma once
+#include <GL/gl.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include "ParticleStore.h"
+#include "ParticleCull.h"
+#include "CubeFaces.h"
+
+/**
+ * ParticleBatch Class
+ * draws every particle from vertex arrays instead of one glut shape each.
+ * the cube or sphere mesh for the current appearance is built once,
+ * then each frame the live particles' copies of it are written into one
+ * position/colour buffer and drawn with a glDrawElements per group of
+ * batchSize particles. normals and indices are the same every frame so
+ * they are only rebuilt when the appearance changes.
+ * with a view set, particles outside it are skipped and the rest are
+ * drawn by their size on screen: the full mesh, a coarse one, or a
+ * point, so far off or tiny particles cost a vertex instead of a sphere.
+ * trails are drawn straight from the particle record's trail arena
+ * as one batch of lines
+ */
+
+class ParticleBatch {
+private:
+	static const int batchSize = 2048; // particles per draw call
+	static const int slices = 10, stacks = 15; // same tessellation as glutSolidSphere
+	static const int lowSlices = 6, lowStacks = 4; // the coarse sphere
+	// a unit mesh with its normals and indices repeated for a full batch
+	struct Mesh {
+		GLenum primitive; // GL_TRIANGLES for solid, GL_LINES for wire
+		std::vector<GLfloat> verts, normals; // unit mesh
+		std::vector<GLuint> indices;
+		std::vector<GLfloat> batchNormals;
+		std::vector<GLuint> batchIndices;
+	};
+	int meshType; // appearance the meshes were built for
+	Mesh full, low;
+	std::vector<GLfloat> vertices; // per-frame buffer
+	std::vector<GLubyte> colors;
+	std::vector<GLubyte> trailColors; // one per arena point
+	std::vector<GLuint> trailIndices; // segments of every live trail
+	ParticleCull cull;
+	bool culling; // skip particles out of view and draw by size?
+	std::vector<unsigned char> lod; // ParticleCull::Lod of each particle this frame
+	size_t drawn[4]; // particles per Lod last frame
+
+	// appends a vertex of a unit mesh
+	static void addVertex(Mesh &m, float x, float y, float z, float nx, float ny, float nz) {
+		m.verts.push_back(x); m.verts.push_back(y); m.verts.push_back(z);
+		m.normals.push_back(nx); m.normals.push_back(ny); m.normals.push_back(nz);
+	}
+	// unit cube of edge 1, like glutSolidCube(1)
+	static void buildCube(Mesh &m, bool wire) {
+		if (wire) { // 8 corners joined by 12 edges
+			for (int c = 0; c < 8; c++) {
+				float x = (c & 1) ? 0.5f : -0.5f, y = (c & 2) ? 0.5f : -0.5f, z = (c & 4) ? 0.5f : -0.5f;
+				addVertex(m, x, y, z, x * 1.1547f, y * 1.1547f, z * 1.1547f);
+			}
+			for (int c = 0; c < 8; c++) {
+				for (int bit = 1; bit < 8; bit <<= 1) {
+					if (!(c & bit)) { m.indices.push_back(c); m.indices.push_back(c | bit); }
+				}
+			}
+			return;
+		}
+		for (int f = 0; f < CubeFaces::faces; f++) {
+			GLuint base = (GLuint)(m.verts.size() / 3);
+			for (int c = 0; c < CubeFaces::corners; c++) {
+				float p[3], n[3];
+				CubeFaces::corner(f, c, p, n);
+				addVertex(m, p[0] * 0.5f, p[1] * 0.5f, p[2] * 0.5f, n[0], n[1], n[2]);
+			}
+			GLuint quad[6] = { base, base + 1, base + 2, base, base + 2, base + 3 };
+			m.indices.insert(m.indices.end(), quad, quad + 6);
+		}
+	}
+	// unit sphere of radius 1, like glutSolidSphere(1, sl, st)
+	static void buildSphere(Mesh &m, bool wire, int sl, int st) {
+		for (int i = 0; i <= st; i++) {
+			float phi = (float)M_PI * i / st;
+			for (int j = 0; j <= sl; j++) {
+				float theta = 2 * (float)M_PI * j / sl;
+				float x = cos(theta) * sin(phi), y = sin(theta) * sin(phi), z = cos(phi);
+				addVertex(m, x, y, z, x, y, z);
+			}
+		}
+		for (int i = 0; i < st; i++) {
+			for (int j = 0; j < sl; j++) {
+				GLuint a = i * (sl + 1) + j, b = a + sl + 1;
+				if (wire) { // one line along the stack and one along the slice
+					GLuint lines[4] = { a, a + 1, a, b };
+					m.indices.insert(m.indices.end(), lines, lines + 4);
+				}
+				else {
+					GLuint tris[6] = { a, b, a + 1, a + 1, b, b + 1 };
+					m.indices.insert(m.indices.end(), tris, tris + 6);
+				}
+			}
+		}
+	}
+	/**
+	 * Mesh building function
+	 * builds a unit mesh for an appearance along with the normals
+	 * and indices of a full batch, which never change afterwards
+	 * @param coarse - the low detail sphere, cubes are already as low as they go
+	 */
+	static void buildMesh(Mesh &m, int appType, bool coarse) {
+		m.verts.clear(); m.normals.clear(); m.indices.clear();
+		switch (appType) {
+			case 1: buildCube(m, false); break;
+			case 2: buildCube(m, true); break;
+			case 3: buildSphere(m, false, coarse ? lowSlices : slices, coarse ? lowStacks : stacks); break;
+			default: buildSphere(m, true, coarse ? lowSlices : slices, coarse ? lowStacks : stacks); break;
+		}
+		m.primitive = (appType == 1 || appType == 3) ? GL_TRIANGLES : GL_LINES;
+		size_t nv = m.verts.size() / 3;
+		m.batchNormals.resize(batchSize * m.normals.size());
+		m.batchIndices.resize(batchSize * m.indices.size());
+		for (size_t p = 0; p < (size_t)batchSize; p++) {
+			std::copy(m.normals.begin(), m.normals.end(), m.batchNormals.begin() + p * m.normals.size());
+			for (size_t k = 0; k < m.indices.size(); k++) {
+				m.batchIndices[p * m.indices.size() + k] = (GLuint)(p * nv + m.indices[k]);
+			}
+		}
+	}
+	/**
+	 * Mesh drawing function
+	 * one copy of the mesh per particle of the wanted level of detail
+	 * Want - the Lod to draw, or Culled to draw every live particle
+	 */
+	template <int Want>
+	void drawMesh(const ParticleStore &ps, const Mesh &m, const int palette[3][3]) {
+		size_t nv = m.verts.size() / 3;
+		vertices.resize(batchSize * m.verts.size());
+		colors.resize(batchSize * nv * 4);
+		glVertexPointer(3, GL_FLOAT, 0, vertices.data());
+		glNormalPointer(GL_FLOAT, 0, m.batchNormals.data());
+		glColorPointer(4, GL_UNSIGNED_BYTE, 0, colors.data());
+		size_t filled = 0;
+		for (size_t p = 0; p <= ps.count(); p++) {
+			bool wanted = (p < ps.count()) && ((Want == ParticleCull::Culled) ? (ps.life[p] > 0) : (lod[p] == Want));
+			if (wanted) { // if particle is alive, and drawn this way
+				float r = ps.size[p] * 5; // cube edge or sphere radius, as with the glut shapes
+				GLfloat *v = &vertices[filled * m.verts.size()];
+				for (size_t k = 0; k < m.verts.size(); k += 3) {
+					v[k] = ps.x[p] + m.verts[k] * r;
+					v[k + 1] = ps.y[p] + m.verts[k + 1] * r;
+					v[k + 2] = ps.z[p] + m.verts[k + 2] * r;
+				}
+				const int *rgb = palette[ps.color[p]];
+				GLubyte alpha = (GLubyte)(((double)ps.life[p] / 100) * 255);
+				GLubyte *c = &colors[filled * nv * 4];
+				for (size_t k = 0; k < nv; k++) {
+					c[4 * k] = rgb[0]; c[4 * k + 1] = rgb[1]; c[4 * k + 2] = rgb[2]; c[4 * k + 3] = alpha;
+				}
+				filled++;
+			}
+			// flush when the batch is full or the record is exhausted
+			if (filled == (size_t)batchSize || (p == ps.count() && filled > 0)) {
+				glDrawElements(m.primitive, (GLsizei)(filled * m.indices.size()), GL_UNSIGNED_INT, m.batchIndices.data());
+				filled = 0;
+			}
+		}
+	}
+	// the particles a few pixels across as unlit points, in one draw
+	void drawPoints(const ParticleStore &ps, const int palette[3][3]) {
+		vertices.clear(); colors.clear();
+		for (size_t p = 0; p < ps.count(); p++) {
+			if (lod[p] != ParticleCull::Point) { continue; }
+			const int *rgb = palette[ps.color[p]];
+			GLfloat v[3] = { ps.x[p], ps.y[p], ps.z[p] };
+			GLubyte c[4] = { (GLubyte)rgb[0], (GLubyte)rgb[1], (GLubyte)rgb[2], (GLubyte)(((double)ps.life[p] / 100) * 255) };
+			vertices.insert(vertices.end(), v, v + 3);
+			colors.insert(colors.end(), c, c + 4);
+		}
+		if (vertices.empty()) { return; }
+		glPushAttrib(GL_ENABLE_BIT | GL_POINT_BIT);
+		glDisable(GL_LIGHTING);
+		glPointSize(2 * lowPixels);
+		glDisableClientState(GL_NORMAL_ARRAY);
+		glVertexPointer(3, GL_FLOAT, 0, vertices.data());
+		glColorPointer(4, GL_UNSIGNED_BYTE, 0, colors.data());
+		glDrawArrays(GL_POINTS, 0, (GLsizei)(vertices.size() / 3));
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glPopAttrib();
+	}
+public:
+	static constexpr float fullPixels = 8, lowPixels = 1.5f; // screen radius the full and coarse meshes start at
+
+	ParticleBatch() {
+		meshType = 0;
+		culling = true;
+		std::fill(drawn, drawn + 4, 0);
+	}
+	/**
+	 * View function, for culling and level of detail
+	 * @param clip - projection times modelview, column major
+	 * @param eye - camera position
+	 * @param pixelScale - pixels a unit at distance 1 covers on screen
+	 */
+	void setView(const float clip[16], const float eye[3], float pixelScale) {
+		cull.setView(clip, eye, pixelScale, fullPixels, lowPixels);
+	}
+	// with culling off every live particle gets the full mesh
+	void setCulling(bool on) {
+		culling = on;
+	}
+	bool isCulling() const {
+		return culling;
+	}
+	// particles drawn last frame at a ParticleCull::Lod, or culled
+	size_t getDrawn(int l) const {
+		return drawn[l];
+	}
+	/**
+	 * Particle drawing function
+	 * @param ps - the particle record
+	 * @param appType - 1 solid cube, 2 wire cube, 3 solid sphere, 4 wire sphere
+	 * @param palette - rgb of each particle color
+	 */
+	void draw(const ParticleStore &ps, int appType, const int palette[3][3]) {
+		if (appType != meshType) {
+			meshType = appType;
+			buildMesh(full, appType, false);
+			buildMesh(low, appType, true);
+		}
+		std::fill(drawn, drawn + 4, 0);
+		if (culling) {
+			lod.resize(ps.count());
+			cull.classify(ps, 0, ps.count(), lod.data());
+			for (size_t p = 0; p < ps.count(); p++) { drawn[lod[p]]++; }
+		}
+		else {
+			for (size_t p = 0; p < ps.count(); p++) { drawn[(ps.life[p] > 0) ? ParticleCull::Full : ParticleCull::Culled]++; }
+		}
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_NORMAL_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		if (!culling) { drawMesh<ParticleCull::Culled>(ps, full, palette); }
+		else {
+			if (drawn[ParticleCull::Full] > 0) { drawMesh<ParticleCull::Full>(ps, full, palette); }
+			if (drawn[ParticleCull::Low] > 0) { drawMesh<ParticleCull::Low>(ps, low, palette); }
+			if (drawn[ParticleCull::Point] > 0) { drawPoints(ps, palette); }
+		}
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_NORMAL_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+	}
+	/**
+	 * Trail drawing function
+	 * the arena is used as the vertex array as is, only the colours
+	 * and the segment indices of the live trails are written
+	 * @param ps - the particle record
+	 */
+	void drawTrails(const ParticleStore &ps) {
+		if (ps.trailCapacity == 0 || ps.trailPoints.empty()) { return; }
+		trailColors.resize(ps.trailPoints.size() / 3 * 4);
+		trailIndices.clear();
+		for (size_t p = 0; p < ps.count(); p++) {
+			if (ps.life[p] <= 0) { continue; } // if particle is dead
+			GLubyte alpha = (GLubyte)(((double)ps.life[p] / 100) * 255);
+			GLubyte *c = &trailColors[(size_t)ps.trailSlot[p] * ps.trailCapacity * 4];
+			for (int k = 0; k < ps.trailCapacity; k++) { // white
+				c[4 * k] = 255; c[4 * k + 1] = 255; c[4 * k + 2] = 255; c[4 * k + 3] = alpha;
+			}
+			ps.trailSegments(p, trailIndices);
+		}
+		if (trailIndices.empty()) { return; }
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glVertexPointer(3, GL_FLOAT, 0, ps.trailPoints.data());
+		glColorPointer(4, GL_UNSIGNED_BYTE, 0, trailColors.data());
+		glDrawElements(GL_LINES, (GLsizei)trailIndices.size(), GL_UNSIGNED_INT, trailIndices.data());
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+	}
+};
@@ -0,0 +1,151 @@
+#pragma once
+#include <math.h>
+#include <stddef.h>
+#include "ParticleStore.h"
+#include "StepKernel.h"
+
+/**
+ * ParticleCull Class
+ * sorts the live particles into what the renderer should draw for them:
+ * nothing when the particle's bounding sphere is outside the view
+ * frustum, else a level of detail by the size it comes out on screen,
+ *   Full - the appearance's full mesh
+ *   Low - a coarse mesh
+ *   Point - a single point, for particles a few pixels across
+ * the frustum is the six planes of the combined projection and view
+ * matrix. like StepKernel there are AVX2 and AVX-512 loops next to the
+ * plain one, doing the same float operations so every version agrees
+ */
+
+class ParticleCull {
+public:
+	enum Lod { Culled = 0, Full = 1, Low = 2, Point = 3 };
+private:
+	float planes[6][4]; // normalized, a point is inside when a.x + d >= 0
+	float eye[3];
+	float fullK, lowK; // a radius r at squared distance d2 is Full when r * r >= fullK * d2
+	StepKernel::Isa isa;
+public:
+	ParticleCull() {
+		isa = StepKernel::detect();
+		float identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 }, origin[3] = { 0, 0, 0 };
+		setView(identity, origin, 1, 8, 1.5f);
+	}
+	StepKernel::Isa getIsa() const {
+		return isa;
+	}
+	// picks an instruction set, capped to what the cpu supports
+	void setIsa(StepKernel::Isa i) {
+		isa = (i > StepKernel::detect()) ? StepKernel::detect() : i;
+	}
+	/**
+	 * View function
+	 * @param clip - projection times modelview, column major as GL keeps it
+	 * @param eyePos - camera position in world space
+	 * @param pixelScale - pixels a unit at distance 1 covers on screen
+	 * @param fullPixels - screen radius from which the full mesh is drawn
+	 * @param lowPixels - screen radius from which the coarse mesh is drawn
+	 */
+	void setView(const float clip[16], const float eyePos[3], float pixelScale, float fullPixels, float lowPixels) {
+		for (int p = 0; p < 6; p++) { // w row plus or minus the x, y and z rows
+			float sign = (p % 2) ? -1.0f : 1.0f;
+			float n = 0;
+			for (int c = 0; c < 4; c++) {
+				planes[p][c] = clip[c * 4 + 3] + sign * clip[c * 4 + p / 2];
+				if (c < 3) { n += planes[p][c] * planes[p][c]; }
+			}
+			n = sqrtf(n);
+			for (int c = 0; c < 4; c++) { planes[p][c] = (n > 0) ? planes[p][c] / n : 0; }
+		}
+		eye[0] = eyePos[0]; eye[1] = eyePos[1]; eye[2] = eyePos[2];
+		fullK = (fullPixels / pixelScale) * (fullPixels / pixelScale);
+		lowK = (lowPixels / pixelScale) * (lowPixels / pixelScale);
+	}
+	/**
+	 * Classifying function
+	 * dead particles are culled too
+	 * @param lod - one Lod per particle, written for [begin, end)
+	 */
+	void classify(const ParticleStore &ps, size_t begin, size_t end, unsigned char *lod) const {
+		size_t i = begin;
+#ifdef STEP_KERNEL_X86
+		if (isa == StepKernel::Avx512) { i = classifyAvx512(ps, begin, end, lod); }
+		else if (isa == StepKernel::Avx2) { i = classifyAvx2(ps, begin, end, lod); }
+#endif
+		for (; i < end; i++) {
+			float x = ps.x[i], y = ps.y[i], z = ps.z[i], r = 5 * ps.size[i];
+			bool in = ps.life[i] > 0;
+			for (int p = 0; p < 6; p++) {
+				in &= (planes[p][0] * x + planes[p][1] * y + planes[p][2] * z + planes[p][3] >= -r);
+			}
+			float ex = x - eye[0], ey = y - eye[1], ez = z - eye[2];
+			float d2 = ex * ex + ey * ey + ez * ez, r2 = r * r;
+			lod[i] = !in ? Culled : (r2 >= fullK * d2) ? Full : (r2 >= lowK * d2) ? Low : Point;
+		}
+	}
+private:
+#ifdef STEP_KERNEL_X86
+	__attribute__((target("avx2")))
+	size_t classifyAvx2(const ParticleStore &ps, size_t begin, size_t end, unsigned char *lod) const {
+		const float *x = ps.x.data(), *y = ps.y.data(), *z = ps.z.data(), *sz = ps.size.data();
+		const int *life = ps.life.data();
+		size_t i = begin;
+		for (; i + 8 <= end; i += 8) {
+			__m256 vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i), vz = _mm256_loadu_ps(z + i);
+			__m256 r = _mm256_mul_ps(_mm256_set1_ps(5.0f), _mm256_loadu_ps(sz + i));
+			__m256 nr = _mm256_sub_ps(_mm256_setzero_ps(), r);
+			__m256i alive = _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(life + i)), _mm256_setzero_si256());
+			__m256 in = _mm256_castsi256_ps(alive);
+			for (int p = 0; p < 6; p++) {
+				__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes[p][0]), vx),
+					_mm256_mul_ps(_mm256_set1_ps(planes[p][1]), vy)), _mm256_mul_ps(_mm256_set1_ps(planes[p][2]), vz)),
+					_mm256_set1_ps(planes[p][3]));
+				in = _mm256_and_ps(in, _mm256_cmp_ps(d, nr, _CMP_GE_OQ));
+			}
+			__m256 ex = _mm256_sub_ps(vx, _mm256_set1_ps(eye[0])), ey = _mm256_sub_ps(vy, _mm256_set1_ps(eye[1]));
+			__m256 ez = _mm256_sub_ps(vz, _mm256_set1_ps(eye[2]));
+			__m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey)), _mm256_mul_ps(ez, ez));
+			__m256 r2 = _mm256_mul_ps(r, r);
+			__m256 full = _mm256_cmp_ps(r2, _mm256_mul_ps(_mm256_set1_ps(fullK), d2), _CMP_GE_OQ);
+			__m256 low = _mm256_cmp_ps(r2, _mm256_mul_ps(_mm256_set1_ps(lowK), d2), _CMP_GE_OQ);
+			__m256 code = _mm256_castsi256_ps(_mm256_set1_epi32(Point));
+			code = _mm256_blendv_ps(code, _mm256_castsi256_ps(_mm256_set1_epi32(Low)), low);
+			code = _mm256_blendv_ps(code, _mm256_castsi256_ps(_mm256_set1_epi32(Full)), full);
+			__m256i c = _mm256_castps_si256(_mm256_and_ps(code, in));
+			__m128i words = _mm_packs_epi32(_mm256_castsi256_si128(c), _mm256_extracti128_si256(c, 1));
+			_mm_storel_epi64((__m128i*)(lod + i), _mm_packus_epi16(words, words));
+		}
+		return i;
+	}
+	__attribute__((target("avx512f")))
+	size_t classifyAvx512(const ParticleStore &ps, size_t begin, size_t end, unsigned char *lod) const {
+		const float *x = ps.x.data(), *y = ps.y.data(), *z = ps.z.data(), *sz = ps.size.data();
+		const int *life = ps.life.data();
+		size_t i = begin;
+		for (; i + 16 <= end; i += 16) {
+			__m512 vx = _mm512_loadu_ps(x + i), vy = _mm512_loadu_ps(y + i), vz = _mm512_loadu_ps(z + i);
+			__m512 r = _mm512_mul_ps(_mm512_set1_ps(5.0f), _mm512_loadu_ps(sz + i));
+			__m512 nr = _mm512_sub_ps(_mm512_setzero_ps(), r);
+			__mmask16 in = _mm512_cmpgt_epi32_mask(_mm512_loadu_si512(life + i), _mm512_setzero_si512());
+			for (int p = 0; p < 6; p++) {
+				__m512 d = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(planes[p][0]), vx),
+					_mm512_mul_ps(_mm512_set1_ps(planes[p][1]), vy)), _mm512_mul_ps(_mm512_set1_ps(planes[p][2]), vz)),
+					_mm512_set1_ps(planes[p][3]));
+				in = _mm512_mask_cmp_ps_mask(in, d, nr, _CMP_GE_OQ);
+			}
+			__m512 ex = _mm512_sub_ps(vx, _mm512_set1_ps(eye[0])), ey = _mm512_sub_ps(vy, _mm512_set1_ps(eye[1]));
+			__m512 ez = _mm512_sub_ps(vz, _mm512_set1_ps(eye[2]));
+			__m512 d2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ex, ex), _mm512_mul_ps(ey, ey)), _mm512_mul_ps(ez, ez));
+			__m512 r2 = _mm512_mul_ps(r, r);
+			__mmask16 full = _mm512_cmp_ps_mask(r2, _mm512_mul_ps(_mm512_set1_ps(fullK), d2), _CMP_GE_OQ);
+			__mmask16 low = _mm512_cmp_ps_mask(r2, _mm512_mul_ps(_mm512_set1_ps(lowK), d2), _CMP_GE_OQ);
+			__m512i code = _mm512_set1_epi32(Point);
+			code = _mm512_mask_mov_epi32(code, low, _mm512_set1_epi32(Low));
+			code = _mm512_mask_mov_epi32(code, full, _mm512_set1_epi32(Full));
+			code = _mm512_maskz_mov_epi32(in, code);
+			_mm512_mask_cvtepi32_storeu_epi8(lod + i, 0xffff, code); // narrowed and stored in one, no spare lanes
+		}
+		return i;
+	}
+#endif
+};
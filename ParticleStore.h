@@ -0,0 +1,525 @@
+#pragma once
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include "Random.h"
+
+/**
+ * ParticleStore Class
+ * structure-of-arrays record of every particle in the scene
+ * particle i is the i-th entry of every array below, so a pass over
+ * one field walks contiguous memory instead of one heap node per particle.
+ * the per-particle logic mirrors the Particle class, indexed by slot.
+ * paths are kept as fixed-capacity rings in one shared arena, each
+ * particle owns a slot of trailCapacity points and overwrites its
+ * oldest point once the slot is full.
+ * removal keeps the capacity of every array and puts the trail slot on
+ * a free list, so once the record has reached its peak a new particle
+ * reuses the room of a dead one and spawning allocates nothing.
+ * the record is split in three: slots below awake hold particles the
+ * step has to move, then come particles that have come to rest and
+ * that the Simulation puts to sleep, then the last dead slots hold
+ * particles whose life has run out. new particles are always awake.
+ * a particle that dies is retired to the dead end of the record, where
+ * the step no longer looks at it, and removeDead drops that end in one
+ * cut. find() looks a particle up by id through an index rebuilt after
+ * anything moves them
+ */
+
+class ParticleStore {
+public:
+	enum {
+		maxDivisor = 1, // how aliased the line is, higher is worse
+		maxBuffer = 5 // frames to ignore repeat collisions
+	};
+	std::vector<float> x, y, z; // position in 3-space
+	std::vector<float> dx, dy, dz; // velocity/direction in 3-space
+	std::vector<float> size; // size of particle
+	std::vector<float> speed; // speed of particle
+	std::vector<int> life; // life of particle
+	std::vector<int> color; // 0 = cyan, 1 = yellow, 2 = magenta
+	std::vector<int> lineDivisor; // for pathdrawing
+	std::vector<int> id; // for identification
+	std::vector<int> buffer; // collision debounce
+	// pathdrawing
+	int trailCapacity; // points kept per trail, 0 records no paths
+	std::vector<float> trailPoints; // xyz of every point, trailCapacity per slot
+	std::vector<int> trailSlot; // arena slot of each particle's trail
+	std::vector<int> trailHead; // oldest point within the slot
+	std::vector<int> trailLength; // points in the trail
+	std::vector<int> freeSlots; // slots of removed particles, reused first
+	size_t awake; // particles [0, awake) are awake, the rest asleep
+	size_t dead; // particles whose life has run out, the last ones in the record
+	uint64_t reshuffles; // bumped whenever particles are added, moved or dropped
+
+	ParticleStore() {
+		trailCapacity = 0;
+		awake = 0;
+		dead = 0;
+		reshuffles = 0;
+		indexedAt = (uint64_t)-1;
+	}
+
+	// number of particles in record
+	size_t count() const {
+		return x.size();
+	}
+	// particles still alive, the record less the dead waiting to be removed
+	size_t alive() const {
+		return count() - dead;
+	}
+	/**
+	 * Particle Creation function
+	 * appends a particle, same spawning rules as the Particle constructor
+	 * @param fp - default spawn position
+	 * @param sr - spread randomness
+	 * @param sf - scale factor of particle
+	 * @param pn - particle number
+	 * @param rs - randomness toggle for speed
+	 * @param seed - run seed, the draws depend on seed and pn alone
+	 */
+	void add(const float fp[3], double sr, float sf, int pn, bool rs, uint64_t seed) {
+		uint32_t r[4];
+		Random::block(seed, (uint64_t)pn, 0, r);
+		x.push_back(fp[0]);
+		y.push_back(fp[1]);
+		z.push_back(fp[2]);
+		// random direction in x-plane, direction is down, random in z-plane
+		dx.push_back((((float)(r[0] % 100) / 100) - 0.5) * sr);
+		dy.push_back(0);
+		dz.push_back((((float)(r[1] % 100) / 100) - 0.5) * sr);
+		// random speed if randomized speed toggle is on
+		speed.push_back((rs) ? ((double)(r[2] % 30) / -10) - 0.01 : -0.01);
+		life.push_back(100);
+		size.push_back(sf);
+		color.push_back(0);
+		lineDivisor.push_back(maxDivisor);
+		id.push_back(pn);
+		buffer.push_back(maxBuffer);
+		trailSlot.push_back(takeSlot());
+		trailHead.push_back(0);
+		trailLength.push_back(0);
+		addTrailPoint(count() - 1, fp[0], fp[1], fp[2]);
+		wakeNewest(1);
+		reshuffles++;
+	}
+	/**
+	 * Batch Creation function
+	 * appends n particles numbered from pn in one pass, every array grows
+	 * once and the fields all particles share are filled in bulk.
+	 * the result is the same as n calls to add(), keep the two in step
+	 * @param fp - default spawn position
+	 * @param sr - spread randomness
+	 * @param sf - scale factor of particle
+	 * @param pn - number of the first particle
+	 * @param n - particles to append
+	 * @param rs - randomness toggle for speed
+	 * @param seed - run seed, the draws depend on seed and number alone
+	 */
+	void addBatch(const float fp[3], double sr, float sf, int pn, size_t n, bool rs, uint64_t seed) {
+		size_t begin = count(), end = begin + n;
+		x.resize(end, fp[0]); y.resize(end, fp[1]); z.resize(end, fp[2]);
+		dx.resize(end); dy.resize(end, 0); dz.resize(end);
+		size.resize(end, sf); speed.resize(end);
+		life.resize(end, 100); color.resize(end, 0);
+		lineDivisor.resize(end, maxDivisor); id.resize(end);
+		buffer.resize(end, maxBuffer); trailSlot.resize(end);
+		trailHead.resize(end, 0); trailLength.resize(end, 0);
+		for (size_t i = begin; i < end; i++) {
+			int number = pn + (int)(i - begin);
+			uint32_t r[4];
+			Random::block(seed, (uint64_t)number, 0, r);
+			// random direction in x-plane, direction is down, random in z-plane
+			dx[i] = (((float)(r[0] % 100) / 100) - 0.5) * sr;
+			dz[i] = (((float)(r[1] % 100) / 100) - 0.5) * sr;
+			// random speed if randomized speed toggle is on
+			speed[i] = (rs) ? ((double)(r[2] % 30) / -10) - 0.01 : -0.01;
+			id[i] = number;
+			trailSlot[i] = takeSlot();
+			addTrailPoint(i, fp[0], fp[1], fp[2]);
+		}
+		wakeNewest(n);
+		reshuffles++;
+	}
+	// copies particle src over slot dst
+	void moveSlot(size_t dst, size_t src) {
+		x[dst] = x[src]; y[dst] = y[src]; z[dst] = z[src];
+		dx[dst] = dx[src]; dy[dst] = dy[src]; dz[dst] = dz[src];
+		size[dst] = size[src]; speed[dst] = speed[src];
+		life[dst] = life[src]; color[dst] = color[src];
+		lineDivisor[dst] = lineDivisor[src]; id[dst] = id[src];
+		buffer[dst] = buffer[src]; trailSlot[dst] = trailSlot[src];
+		trailHead[dst] = trailHead[src]; trailLength[dst] = trailLength[src];
+		reshuffles++;
+	}
+	// exchanges particles a and b
+	void swapSlots(size_t a, size_t b) {
+		std::swap(x[a], x[b]); std::swap(y[a], y[b]); std::swap(z[a], z[b]);
+		std::swap(dx[a], dx[b]); std::swap(dy[a], dy[b]); std::swap(dz[a], dz[b]);
+		std::swap(size[a], size[b]); std::swap(speed[a], speed[b]);
+		std::swap(life[a], life[b]); std::swap(color[a], color[b]);
+		std::swap(lineDivisor[a], lineDivisor[b]); std::swap(id[a], id[b]);
+		std::swap(buffer[a], buffer[b]); std::swap(trailSlot[a], trailSlot[b]);
+		std::swap(trailHead[a], trailHead[b]); std::swap(trailLength[a], trailLength[b]);
+		reshuffles++;
+	}
+	/**
+	 * Capacity function
+	 * sizes every array and the trail arena for n particles up front, so
+	 * spawning up to n, and respawning into the room left by the dead,
+	 * never goes to the heap. the arena is sized for the current trail
+	 * capacity, setTrailCapacity() starts a new one
+	 * @param n - particles to make room for
+	 */
+	void reserve(size_t n) {
+		x.reserve(n); y.reserve(n); z.reserve(n);
+		dx.reserve(n); dy.reserve(n); dz.reserve(n);
+		size.reserve(n); speed.reserve(n);
+		life.reserve(n); color.reserve(n);
+		lineDivisor.reserve(n); id.reserve(n);
+		buffer.reserve(n); trailSlot.reserve(n);
+		trailHead.reserve(n); trailLength.reserve(n);
+		freeSlots.reserve(n);
+		trailPoints.reserve(n * trailCapacity * 3);
+	}
+	/**
+	 * Dead removal function
+	 * drops the dead end of the record, the live particles stay where
+	 * they are
+	 * @return number removed
+	 */
+	size_t removeDead() {
+		size_t n = count(), w = n - dead;
+		if (trailCapacity > 0) {
+			for (size_t i = w; i < n; i++) { freeSlots.push_back(trailSlot[i]); } // trail slot is reused
+		}
+		x.resize(w); y.resize(w); z.resize(w);
+		dx.resize(w); dy.resize(w); dz.resize(w);
+		size.resize(w); speed.resize(w);
+		life.resize(w); color.resize(w);
+		lineDivisor.resize(w); id.resize(w);
+		buffer.resize(w); trailSlot.resize(w);
+		trailHead.resize(w); trailLength.resize(w);
+		dead = 0;
+		reshuffles++;
+		return n - w;
+	}
+	/**
+	 * Retiring function
+	 * moves particle i, whose life has run out, to the dead end of the
+	 * record. the last awake particle takes its slot if it was awake,
+	 * and the last sleeper fills the gap that leaves
+	 */
+	void retire(size_t i) {
+		if (i < awake) {
+			awake--;
+			if (i != awake) { swapSlots(i, awake); }
+			i = awake;
+		}
+		size_t last = count() - dead - 1;
+		if (i != last) { swapSlots(i, last); }
+		dead++;
+	}
+	// retires every dead particle afresh, for a record written from outside
+	void retireDead() {
+		dead = 0;
+		awake = std::min(awake, count());
+		for (size_t i = 0; i < count() - dead;) {
+			if (life[i] <= 0) { retire(i); }
+			else { i++; }
+		}
+	}
+	/**
+	 * Lookup function
+	 * the slot of the particle with a given id. the id index is rebuilt
+	 * first if particles have moved since it was built, so lookups
+	 * between steps cost a binary search
+	 * @param pid - particle id
+	 * @return its slot, or -1 if no particle in the record has that id
+	 */
+	long find(int pid) {
+		if (indexedAt != reshuffles) {
+			byId.resize(count());
+			for (size_t i = 0; i < count(); i++) { byId[i] = ((uint64_t)(uint32_t)id[i] << 32) | i; }
+			std::sort(byId.begin(), byId.end());
+			indexedAt = reshuffles;
+		}
+		std::vector<uint64_t>::const_iterator it = std::lower_bound(byId.begin(), byId.end(), (uint64_t)(uint32_t)pid << 32);
+		return (it != byId.end() && (*it >> 32) == (uint32_t)pid) ? (long)(*it & 0xffffffffu) : -1;
+	}
+	// number of particles asleep
+	size_t sleeping() const {
+		return count() - dead - awake;
+	}
+	// puts awake particle i to sleep, the last awake particle takes its slot
+	void sleep(size_t i) {
+		awake--;
+		if (i != awake) { swapSlots(i, awake); }
+	}
+	// wakes every live particle, the order is kept
+	void wakeAll() {
+		awake = count() - dead;
+	}
+	/**
+	 * New particle waking function
+	 * the last n particles were just appended behind the sleepers and
+	 * the dead. the dead in their way swap places with them, then the
+	 * sleepers do
+	 */
+	void wakeNewest(size_t n) {
+		size_t end = count() - n;
+		swapBlocks(end - dead, end, n); // past the dead
+		swapBlocks(awake, end - dead, n); // past the sleepers
+		awake += n;
+	}
+	/**
+	 * Block moving function
+	 * moves the n particles at [from, from + n) down to [to, to + n),
+	 * the ones in between end up behind them. only as many swaps as
+	 * the smaller of the two blocks
+	 */
+	void swapBlocks(size_t to, size_t from, size_t n) {
+		size_t moved = std::min(n, from - to);
+		for (size_t j = 0; j < moved; j++) { swapSlots(to + j, from + n - moved + j); }
+	}
+	// empties the record
+	void clear() {
+		x.clear(); y.clear(); z.clear();
+		dx.clear(); dy.clear(); dz.clear();
+		size.clear(); speed.clear();
+		life.clear(); color.clear();
+		lineDivisor.clear(); id.clear();
+		buffer.clear(); trailSlot.clear();
+		trailHead.clear(); trailLength.clear();
+		trailPoints.clear(); freeSlots.clear();
+		awake = 0;
+		dead = 0;
+		reshuffles++;
+	}
+	/**
+	 * Trail capacity function
+	 * resizes every trail, keeping the newest points that still fit.
+	 * a capacity of 0 frees the arena and stops recording paths
+	 * @param c - points kept per trail
+	 */
+	void setTrailCapacity(int c) {
+		std::vector<float> points((size_t)c * 3 * count());
+		for (size_t i = 0; i < count(); i++) { // lay slots out in record order
+			int keep = std::min(trailLength[i], c);
+			for (int k = 0; k < keep; k++) {
+				const float *src = trailPoint(i, trailLength[i] - keep + k);
+				std::copy(src, src + 3, &points[((size_t)i * c + k) * 3]);
+			}
+			trailSlot[i] = (int)i; trailHead[i] = 0; trailLength[i] = keep;
+		}
+		trailPoints.swap(points);
+		freeSlots.clear();
+		trailCapacity = c;
+	}
+	// k-th oldest point of a trail, as xyz
+	const float *trailPoint(size_t i, int k) const {
+		size_t slot = trailSlot[i];
+		return &trailPoints[(slot * trailCapacity + (trailHead[i] + k) % trailCapacity) * 3];
+	}
+	/**
+	 * Trail point function
+	 * appends a point to a trail, overwriting the oldest if it is full
+	 */
+	void addTrailPoint(size_t i, float px, float py, float pz) {
+		if (trailCapacity == 0) { return; }
+		int k;
+		if (trailLength[i] < trailCapacity) {
+			k = (trailHead[i] + trailLength[i]++) % trailCapacity;
+		}
+		else { // ring is full, the oldest point makes way
+			k = trailHead[i];
+			trailHead[i] = (trailHead[i] + 1) % trailCapacity;
+		}
+		float *dst = &trailPoints[((size_t)trailSlot[i] * trailCapacity + k) * 3];
+		dst[0] = px; dst[1] = py; dst[2] = pz;
+	}
+	/**
+	 * Trail segment function
+	 * appends the arena indices of each line segment of a trail,
+	 * two per segment, oldest first, for drawing straight from the arena
+	 */
+	void trailSegments(size_t i, std::vector<unsigned int> &out) const {
+		unsigned int base = (unsigned int)trailSlot[i] * trailCapacity;
+		for (int k = 0; k + 1 < trailLength[i]; k++) {
+			out.push_back(base + (trailHead[i] + k) % trailCapacity);
+			out.push_back(base + (trailHead[i] + k + 1) % trailCapacity);
+		}
+	}
+	// arena slot for a new trail, -1 when paths are off
+	int takeSlot() {
+		if (trailCapacity == 0) { return -1; }
+		if (!freeSlots.empty()) {
+			int slot = freeSlots.back();
+			freeSlots.pop_back();
+			return slot;
+		}
+		trailPoints.resize(trailPoints.size() + (size_t)trailCapacity * 3);
+		return (int)(trailPoints.size() / 3 / trailCapacity) - 1;
+	}
+	// folds the bytes of an array into an FNV-1a hash
+	template <class T>
+	static void hashArray(uint64_t &h, const std::vector<T> &v) {
+		const unsigned char *b = (const unsigned char*)v.data();
+		for (size_t k = 0; k < v.size() * sizeof(T); k++) { h = (h ^ b[k]) * 1099511628211ull; }
+	}
+	/**
+	 * State checksum function
+	 * hash of every per-particle array, two runs that end on the
+	 * same checksum ended bit-identical
+	 */
+	uint64_t checksum() const {
+		uint64_t h = 14695981039346656037ull;
+		hashArray(h, x); hashArray(h, y); hashArray(h, z);
+		hashArray(h, dx); hashArray(h, dy); hashArray(h, dz);
+		hashArray(h, size); hashArray(h, speed); hashArray(h, life); hashArray(h, color);
+		hashArray(h, lineDivisor); hashArray(h, id); hashArray(h, buffer);
+		return h;
+	}
+	std::array<float, 3> getPos(size_t i) const {
+		return std::array<float, 3>{ x[i], y[i], z[i] };
+	}
+	/**
+	 * Velocity Changing function
+	 * for interparticle collision, determine in which way to reflect off others
+	 * @param a - whether to reflect in x-plane
+	 * @param b - in z-plane
+	 * @param c - in y-plane
+	 */
+	void changeDirection(size_t i, bool a, bool b, bool c) {
+		if (buffer[i] == maxBuffer) {
+			dx[i] = (a) ? -dx[i] : dx[i]; // change in x
+			dz[i] = (b) ? -dz[i] : dz[i]; // change in z
+			speed[i] = (c) ? -speed[i] : speed[i]; // change in y
+		}
+		// collisions may happen upon multiple frames, don't bounce and then bounce back
+		buffer[i] = (buffer[i] == 0) ? maxBuffer : buffer[i] - 1;
+	}
+	/**
+	 * Particle movement function
+	 * @param g - gravity
+	 */
+	void move(size_t i, double g) {
+		speed[i] -= g; // gravity affects speed in y-plane
+		x[i] += dx[i];
+		y[i] += dy[i] + speed[i];
+		z[i] += dz[i];
+		recordPath(i);
+	}
+	/**
+	 * Path drawing function
+	 * called after each move, adds a new point every maxDivisor steps
+	 */
+	void recordPath(size_t i) {
+		if (lineDivisor[i] > 0) {
+			lineDivisor[i]--;
+		}
+		else if (lineDivisor[i] == 0 && speed[i] != 0) {
+			addTrailPoint(i, x[i], y[i], z[i]);
+			lineDivisor[i] = maxDivisor;
+		}
+	}
+	/**
+	 * Bounce physics vs floor function
+	 * @param c - floor position
+	 * @param f - friction
+	 */
+	void bounce(size_t i, float c, double f) {
+		y[i] = c + 5 * size[i]; // need offset for particle size
+		speed[i] = round(10000 * (-speed[i] / (1 + f))) / 10000;
+	}
+	/**
+	 * Particle Life function
+	 * @param g - gravity
+	 */
+	bool checkDead(size_t i, double g) {
+		if (life[i] < 100) { // non-100 life is stationary
+			life[i]--;
+			return true;
+		} else if (speed[i] <= (g - 0.01) && speed[i] != 0) {
+			speed[i] = 0.0; // if arbitrarily close to stationary
+			return true;
+		}
+		return false;
+	}
+	/**
+	 * Check if below killplane method
+	 * @param rp - if we want to delete particle records
+	 * @param lf - the lowest floor of the pyramid
+	 */
+	void checkOffPyramid(size_t i, bool rp, float lf) {
+		if (speed[i] == 0 || y[i] < lf) {
+			color[i] = 2; // change to magenta
+			if (rp || y[i] < lf) {
+				life[i]--;
+			}
+		}
+	}
+	// to change color of particle
+	void changeColor(size_t i) {
+		color[i] = (color[i] == 2) ? 2 : color[i] + 1;
+	}
+	/**
+	 * Divisor countdown function
+	 * recordPath for every particle of a range that moved, while no
+	 * trails are kept: the divisors count the same but no point is added
+	 * @param moved - nonzero for the particles that moved
+	 */
+	__attribute__((optimize("tree-vectorize", "vect-cost-model=dynamic")))
+	void countDivisors(size_t begin, size_t end, const unsigned char *__restrict moved) {
+		int *__restrict ld = lineDivisor.data();
+		const float *__restrict sp = speed.data();
+		for (size_t i = begin; i < end; i++) {
+			int d = ld[i];
+			int next = d - (d > 0) + ((d == 0) & (sp[i] != 0)) * maxDivisor;
+			ld[i] = moved[i] ? next : d;
+		}
+	}
+	/**
+	 * Landing function
+	 * what a step does to a range once the floors are tested: the colour
+	 * change and checkDead of a particle that hit one, then
+	 * checkOffPyramid, as selects with no branches
+	 * @param hit - floor hit by each particle, zero for none
+	 * @param g - gravity
+	 * @param lf - the lowest floor of the pyramid
+	 * @param died - set to the particles whose life ran out
+	 * @return particles that hit a floor
+	 */
+	template <bool Remove>
+	__attribute__((optimize("tree-vectorize", "vect-cost-model=dynamic")))
+	size_t land(size_t begin, size_t end, const float *__restrict hit, double g, float lf, size_t &died) {
+		float *__restrict sp = speed.data();
+		int *__restrict lv = life.data();
+		int *__restrict cl = color.data();
+		const float *__restrict py = y.data();
+		float stop = (float)(g - 0.01); // the largest float checkDead's double compare lets stop
+		if ((double)stop > g - 0.01) { stop = nextafterf(stop, -INFINITY); }
+		int bounces = 0, deaths = 0;
+		for (size_t i = begin; i < end; i++) { // & and | rather than && and ||, which would branch
+			int h = (hit[i] != 0), c = cl[i], l = lv[i];
+			float s = sp[i];
+			int dying = (l < 100), halt = h & (dying ^ 1) & (s <= stop) & (s != 0); // checkDead stops it
+			int low = (py[i] < lf), off = (s == 0) | halt | low;
+			c += h & (c == 0); // cyan to yellow on a bounce
+			c += h & dying & (c == 1); // yellow to magenta when dying
+			c = off ? 2 : c; // magenta at rest or off the pyramid
+			int was = l;
+			l -= (h & dying) + (off & (Remove | low));
+			cl[i] = c; lv[i] = l; sp[i] = halt ? 0.0f : s;
+			bounces += h;
+			deaths += (was > 0) & (l <= 0);
+		}
+		died = deaths;
+		return bounces;
+	}
+private:
+	std::vector<uint64_t> byId; // id in the high half, slot in the low, sorted
+	uint64_t indexedAt; // reshuffles when byId was built
+};
\ No newline at end of file
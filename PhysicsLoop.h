@@ -0,0 +1,151 @@
+#pragma once
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Simulation.h"
+#include "TripleBuffer.h"
+
+/**
+ * Snapshot Struct
+ * what the renderer needs of one physics step
+ */
+
+struct Snapshot {
+	ParticleStore particles; // live particles, only position, size, life, colour and trails are filled in
+	std::vector<Floor> floors;
+	long steps; // physics steps taken so far
+	Snapshot() : steps(0) {}
+};
+
+/**
+ * PhysicsLoop Class
+ * advances a Simulation on a fixed timestep, independent of the frame rate.
+ * elapsed real time, scaled by timeScale, is added to an accumulator that
+ * is drained one step of stepSeconds at a time, so a frame runs anywhere
+ * from 0 to maxSubsteps steps. past that the backlog is dropped instead of
+ * letting a slow frame snowball. the loop runs on the caller, once per
+ * frame, or on its own thread. either way each advance ends by copying
+ * what the renderer draws of the scene into a triple buffer that it reads
+ * from, so a slow frame
+ * never holds up the physics and a slow step never holds up a frame.
+ * the simulation and the settings below may only be changed under lock
+ */
+
+class PhysicsLoop {
+public:
+	double stepSeconds; // simulated time of one step
+	double timeScale; // simulated seconds per real second
+	int maxSubsteps; // most steps one advance may run
+	bool paused;
+	std::function<void()> onStep; // runs before every step, e.g. to fire particles
+	std::mutex lock; // guards the simulation and the settings
+
+	/**
+	 * PhysicsLoop Constructor
+	 * @param s - the simulation to advance
+	 */
+	PhysicsLoop(Simulation &s) : stepSeconds(0.02), timeScale(1), maxSubsteps(8), paused(false),
+		sim(s), accumulator(0), steps(0), running(false) {
+		last = std::chrono::steady_clock::now();
+		publish();
+	}
+	~PhysicsLoop() {
+		setThreaded(false);
+	}
+	/**
+	 * Function to move the physics onto its own thread or back
+	 * @param on - true to step on a dedicated thread
+	 */
+	void setThreaded(bool on) {
+		if (on == running) { return; }
+		running = on;
+		if (on) { worker = std::thread(&PhysicsLoop::run, this); }
+		else { worker.join(); }
+	}
+	bool isThreaded() const {
+		return running;
+	}
+	/**
+	 * Frame advance function
+	 * runs the steps owed since the last call, once per frame.
+	 * does nothing while the loop has a thread of its own
+	 */
+	void advance() {
+		if (running) { return; }
+		std::lock_guard<std::mutex> guard(lock);
+		tick();
+	}
+	// newest complete step, only for the renderer
+	Snapshot &frame() {
+		return buffer.read();
+	}
+private:
+	Simulation &sim;
+	TripleBuffer<Snapshot> buffer; // steps handed to the renderer
+	std::chrono::steady_clock::time_point last; // time of the previous advance
+	double accumulator; // simulated seconds owed
+	long steps;
+	std::atomic<bool> running; // physics thread alive?
+	std::thread worker;
+
+	// runs the steps owed and publishes the result, under lock
+	void tick() {
+		PROFILE_SCOPE(Advance);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (!paused) { accumulator += std::chrono::duration<double>(now - last).count() * timeScale; }
+		last = now;
+		int n = 0;
+		for (; accumulator >= stepSeconds && n < maxSubsteps; n++) {
+			if (onStep) { onStep(); }
+			sim.step();
+			accumulator -= stepSeconds;
+			steps++;
+		}
+		if (n == maxSubsteps) { accumulator = fmod(accumulator, stepSeconds); } // fell behind, drop the backlog
+		publish();
+	}
+	// first n values of an array into a snapshot's, reusing its capacity
+	template <class T>
+	static void take(const std::vector<T> &from, std::vector<T> &to, size_t n) {
+		to.assign(from.begin(), from.begin() + n);
+	}
+	/**
+	 * Publishing function
+	 * copies the arrays the renderer reads into the writer's slot and hands
+	 * it over. the dead at the end of the record are left out, as are the
+	 * velocities, ids and collision state, which only the step needs
+	 */
+	void publish() {
+		Snapshot &s = buffer.write();
+		const ParticleStore &ps = sim.particles;
+		ParticleStore &out = s.particles;
+		size_t n = ps.alive();
+		take(ps.x, out.x, n); take(ps.y, out.y, n); take(ps.z, out.z, n);
+		take(ps.size, out.size, n); take(ps.life, out.life, n); take(ps.color, out.color, n);
+		out.trailCapacity = ps.trailCapacity;
+		size_t trails = (ps.trailCapacity > 0) ? n : 0;
+		take(ps.trailSlot, out.trailSlot, trails); take(ps.trailHead, out.trailHead, trails);
+		take(ps.trailLength, out.trailLength, trails);
+		take(ps.trailPoints, out.trailPoints, (ps.trailCapacity > 0) ? ps.trailPoints.size() : 0);
+		out.awake = std::min(ps.awake, n);
+		s.floors.assign(sim.listFloors.begin(), sim.listFloors.end());
+		s.steps = steps;
+		buffer.publish();
+	}
+	// body of the physics thread, wakes about once per step
+	void run() {
+		while (running) {
+			double wait;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				tick();
+				wait = (paused || timeScale <= 0) ? stepSeconds : stepSeconds / timeScale;
+			}
+			std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+		}
+	}
+};
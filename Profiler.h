@@ -0,0 +1,260 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Profiler Class
+ * times the phases of the step and the frame and counts what the step
+ * did, for the whole process. a phase is timed by putting
+ * PROFILE_SCOPE(phase) at the top of its block, a counter is bumped with
+ * PROFILE_COUNT(counter, n). endStep() closes the step: its counters go
+ * into the totals and into a log2 histogram of per-step values, and a
+ * row of phase times and counters is kept when a CSV is wanted.
+ * phases also land in a Chrome trace (chrome://tracing) while tracing.
+ * building with -DNO_PROFILER compiles the timers and counters out
+ */
+
+class Profiler {
+public:
+	enum Phase { Step, Move, Collide, Remove, Advance, Frame, phaseCount };
+	enum Counter { CollisionTests, CollisionHits, Bounces, Removals, counterCount };
+	enum { buckets = 32 }; // histogram bucket b holds steps with a count in [2^b - 1, 2^(b+1) - 1)
+
+	// totals since the last reset, plain data so two can be subtracted
+	struct Stats {
+		int64_t phaseNs[phaseCount]; // summed duration
+		int64_t phaseCalls[phaseCount];
+		int64_t phaseMaxNs[phaseCount]; // longest single call
+		int64_t counts[counterCount];
+		int64_t histogram[counterCount][buckets];
+		int64_t steps;
+		// what happened between earlier and this, maxima are kept as they are
+		Stats since(const Stats &earlier) const {
+			Stats d = *this;
+			for (int p = 0; p < phaseCount; p++) {
+				d.phaseNs[p] -= earlier.phaseNs[p];
+				d.phaseCalls[p] -= earlier.phaseCalls[p];
+			}
+			for (int c = 0; c < counterCount; c++) {
+				d.counts[c] -= earlier.counts[c];
+				for (int b = 0; b < buckets; b++) { d.histogram[c][b] -= earlier.histogram[c][b]; }
+			}
+			d.steps -= earlier.steps;
+			return d;
+		}
+		// mean milliseconds per call of a phase
+		double meanMs(int p) const {
+			return (phaseCalls[p] > 0) ? phaseNs[p] / 1e6 / phaseCalls[p] : 0;
+		}
+	};
+
+	static Profiler &get() {
+		static Profiler profiler;
+		return profiler;
+	}
+	static const char *phaseName(int p) {
+		static const char *names[phaseCount] = { "step", "move", "collide", "remove", "advance", "frame" };
+		return names[p];
+	}
+	static const char *counterName(int c) {
+		static const char *names[counterCount] = { "collision tests", "collision hits", "bounces", "removals" };
+		return names[c];
+	}
+	// nanoseconds since the profiler started
+	int64_t now() const {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+	}
+	// clears every total, the histogram and the kept rows and events
+	void reset() {
+		std::lock_guard<std::mutex> guard(lock);
+		memset(&totals, 0, sizeof(totals));
+		for (int c = 0; c < counterCount; c++) { stepCounts[c] = 0; }
+		stepPhaseNs.assign(phaseCount, 0);
+		rows.clear(); events.clear();
+	}
+	Stats stats() {
+		std::lock_guard<std::mutex> guard(lock);
+		return totals;
+	}
+	/**
+	 * Phase timing function, called when a scope ends
+	 * @param p - the phase
+	 * @param begin - start of the scope from now()
+	 * @param end - end of the scope from now()
+	 */
+	void addTime(Phase p, int64_t begin, int64_t end) {
+		std::lock_guard<std::mutex> guard(lock);
+		int64_t ns = end - begin;
+		totals.phaseNs[p] += ns;
+		totals.phaseCalls[p]++;
+		if (ns > totals.phaseMaxNs[p]) { totals.phaseMaxNs[p] = ns; }
+		stepPhaseNs[p] += ns;
+		if (tracing && events.size() < maxEvents) {
+			Event e = { p, begin, ns, threadNumber() };
+			events.push_back(e);
+		}
+	}
+	// adds to a counter of the current step, safe from any thread
+	void count(Counter c, int64_t n) {
+		stepCounts[c].fetch_add(n, std::memory_order_relaxed);
+	}
+	/**
+	 * Step closing function
+	 * folds the step's counters into the totals and the histogram
+	 */
+	void endStep() {
+		std::lock_guard<std::mutex> guard(lock);
+		Row row;
+		for (int c = 0; c < counterCount; c++) {
+			int64_t n = stepCounts[c].exchange(0);
+			totals.counts[c] += n;
+			int b = 0;
+			while (b + 1 < buckets && n + 1 >= ((int64_t)2 << b)) { b++; }
+			totals.histogram[c][b]++;
+			row.counts[c] = n;
+		}
+		for (int p = 0; p < phaseCount; p++) {
+			row.phaseNs[p] = stepPhaseNs[p];
+			stepPhaseNs[p] = 0;
+		}
+		row.step = totals.steps++;
+		if (keepRows) { rows.push_back(row); }
+	}
+	// keep one CSV row per step from now on
+	void setKeepRows(bool on) {
+		std::lock_guard<std::mutex> guard(lock);
+		keepRows = on;
+	}
+	// collect phase events for a Chrome trace from now on
+	void setTracing(bool on) {
+		std::lock_guard<std::mutex> guard(lock);
+		tracing = on;
+	}
+	/**
+	 * CSV export function
+	 * one row per step kept: phase times in ms, then the counters
+	 * @return false if the file could not be written
+	 */
+	bool writeCsv(const char *path) {
+		std::lock_guard<std::mutex> guard(lock);
+		FILE *f = fopen(path, "w");
+		if (!f) { return false; }
+		fprintf(f, "step");
+		for (int p = 0; p < phaseCount; p++) { fprintf(f, ",%s_ms", phaseName(p)); }
+		for (int c = 0; c < counterCount; c++) { fprintf(f, ",%s", counterName(c)); }
+		fprintf(f, "\n");
+		for (size_t r = 0; r < rows.size(); r++) {
+			fprintf(f, "%lld", (long long)rows[r].step);
+			for (int p = 0; p < phaseCount; p++) { fprintf(f, ",%.4f", rows[r].phaseNs[p] / 1e6); }
+			for (int c = 0; c < counterCount; c++) { fprintf(f, ",%lld", (long long)rows[r].counts[c]); }
+			fprintf(f, "\n");
+		}
+		return fclose(f) == 0;
+	}
+	/**
+	 * Chrome trace export function
+	 * every phase event collected while tracing, as complete events
+	 * @return false if the file could not be written
+	 */
+	bool writeTrace(const char *path) {
+		std::lock_guard<std::mutex> guard(lock);
+		FILE *f = fopen(path, "w");
+		if (!f) { return false; }
+		fprintf(f, "{\"traceEvents\":[");
+		for (size_t e = 0; e < events.size(); e++) {
+			fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d}",
+				(e > 0) ? "," : "", phaseName(events[e].phase), events[e].begin / 1e3, events[e].ns / 1e3, events[e].thread);
+		}
+		fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+		return fclose(f) == 0;
+	}
+	/**
+	 * Summary function
+	 * prints the mean and longest time of each phase and the counters
+	 * per step with their histograms
+	 */
+	static void print(FILE *f, const Stats &s) {
+		fprintf(f, "%-10s %10s %12s %12s\n", "phase", "calls", "mean ms", "max ms");
+		for (int p = 0; p < phaseCount; p++) {
+			if (s.phaseCalls[p] == 0) { continue; }
+			fprintf(f, "%-10s %10lld %12.4f %12.4f\n", phaseName(p), (long long)s.phaseCalls[p], s.meanMs(p), s.phaseMaxNs[p] / 1e6);
+		}
+		fprintf(f, "%-16s %14s %12s  %s\n", "counter", "total", "per step", "steps by count: [0] [1,2] [3,6] ...");
+		for (int c = 0; c < counterCount; c++) {
+			fprintf(f, "%-16s %14lld %12.1f ", counterName(c), (long long)s.counts[c],
+				(s.steps > 0) ? (double)s.counts[c] / s.steps : 0);
+			int last = buckets - 1;
+			while (last > 0 && s.histogram[c][last] == 0) { last--; }
+			for (int b = 0; b <= last; b++) { fprintf(f, " %lld", (long long)s.histogram[c][b]); }
+			fprintf(f, "\n");
+		}
+	}
+private:
+	enum { maxEvents = 1 << 20 }; // trace events kept at most
+	struct Row {
+		int64_t step;
+		int64_t phaseNs[phaseCount];
+		int64_t counts[counterCount];
+	};
+	struct Event {
+		int phase;
+		int64_t begin, ns;
+		int thread;
+	};
+	std::chrono::steady_clock::time_point origin;
+	std::mutex lock; // guards everything but the step counters
+	Stats totals;
+	std::atomic<int64_t> stepCounts[counterCount]; // counters of the current step
+	std::vector<int64_t> stepPhaseNs; // phase times of the current step
+	std::vector<Row> rows;
+	std::vector<Event> events;
+	std::vector<std::thread::id> threads; // trace thread numbers, by first appearance
+	bool keepRows, tracing;
+
+	Profiler() : origin(std::chrono::steady_clock::now()), keepRows(false), tracing(false) {
+		reset();
+	}
+	// small stable number for the calling thread, under lock
+	int threadNumber() {
+		std::thread::id me = std::this_thread::get_id();
+		for (size_t t = 0; t < threads.size(); t++) {
+			if (threads[t] == me) { return (int)t; }
+		}
+		threads.push_back(me);
+		return (int)threads.size() - 1;
+	}
+};
+
+/**
+ * ProfileScope Class
+ * times its own lifetime as one call of a phase
+ */
+
+class ProfileScope {
+private:
+	Profiler::Phase phase;
+	int64_t begin;
+public:
+	ProfileScope(Profiler::Phase p) : phase(p), begin(Profiler::get().now()) {}
+	~ProfileScope() {
+		Profiler::get().addTime(phase, begin, Profiler::get().now());
+	}
+};
+
+#ifdef NO_PROFILER
+#define PROFILE_SCOPE(phase)
+#define PROFILE_COUNT(counter, n) ((void)(n))
+#define PROFILE_END_STEP()
+#else
+#define PROFILE_JOIN(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_JOIN(profileScope, line)
+#define PROFILE_SCOPE(phase) ProfileScope PROFILE_NAME(__LINE__)(Profiler::phase)
+#define PROFILE_COUNT(counter, n) Profiler::get().count(Profiler::counter, n)
+#define PROFILE_END_STEP() Profiler::get().endStep()
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * Random Class
+ * counter-based generator, Philox4x32-10 (Salmon et al., SC 2011).
+ * a block of four 32 bit values is a pure function of a 64 bit key and
+ * a 128 bit counter, there is no state to carry from draw to draw. the
+ * key is the run's seed and the counter names what is being drawn, so
+ * a particle's spread and speed follow from (seed, id) alone and can be
+ * drawn on any thread in any order
+ */
+
+class Random {
+private:
+	// multiply and split into the high and low halves
+	static inline void mulhilo(uint32_t a, uint32_t b, uint32_t &hi, uint32_t &lo) {
+		uint64_t p = (uint64_t)a * b;
+		hi = (uint32_t)(p >> 32);
+		lo = (uint32_t)p;
+	}
+public:
+	/**
+	 * Block function
+	 * @param key - the seed
+	 * @param counter - what is being drawn, e.g. a particle id
+	 * @param stream - which block for that counter, 0 for the first
+	 * @param out - four uniformly distributed 32 bit values
+	 */
+	static void block(uint64_t key, uint64_t counter, uint32_t stream, uint32_t out[4]) {
+		uint32_t c0 = (uint32_t)counter, c1 = (uint32_t)(counter >> 32), c2 = stream, c3 = 0;
+		uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+		for (int r = 0; r < 10; r++) {
+			uint32_t hi0, lo0, hi1, lo1;
+			mulhilo(0xD2511F53u, c0, hi0, lo0);
+			mulhilo(0xCD9E8D57u, c2, hi1, lo1);
+			c0 = hi1 ^ c1 ^ k0; c1 = lo1;
+			c2 = hi0 ^ c3 ^ k1; c3 = lo0;
+			k0 += 0x9E3779B9u; k1 += 0xBB67AE85u; // bump the key between rounds
+		}
+		out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+	}
+};
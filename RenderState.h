@@ -0,0 +1,137 @@
+#pragma once
+#include <GL/gl.h>
+#include <GL/glu.h>
+#include <math.h>
+
+/**
+ * RenderState Class
+ * a cache of the fixed-function state the scene is drawn with. each
+ * setter remembers what the GL was last told and only calls it when the
+ * value differs, so a frame whose lighting, shading, culling and camera
+ * match the last one costs no state calls at all. the state that never
+ * changes is set once by init(). anything that changes GL state behind
+ * the cache's back, like the profiler overlay, has to go through it too
+ * or call invalidate() afterwards
+ */
+
+class RenderState {
+public:
+	enum Cap { Lighting, DepthTest, CullFace, capCount };
+private:
+	int caps[capCount]; // last value set, -1 for unknown
+	int smooth; // last shade model, -1 for unknown
+	bool cameraKnown; // projection and view match the fields below
+	int viewWidth, viewHeight;
+	double camZoom, camYRotate, camXRotate;
+	GLfloat clip[16]; // projection times view, column major
+	GLfloat eye[3]; // camera position
+
+	static GLenum glCap(Cap c) {
+		static const GLenum caps[capCount] = { GL_LIGHTING, GL_DEPTH_TEST, GL_CULL_FACE };
+		return caps[c];
+	}
+public:
+	RenderState() : viewWidth(1), viewHeight(1) {
+		invalidate();
+		for (int k = 0; k < 16; k++) { clip[k] = (k % 5 == 0) ? 1.0f : 0.0f; }
+		eye[0] = eye[1] = eye[2] = 0;
+	}
+	// forgets everything, the next setters all call the GL
+	void invalidate() {
+		for (int c = 0; c < capCount; c++) { caps[c] = -1; }
+		smooth = -1;
+		cameraKnown = false;
+	}
+	/**
+	 * Fixed state function
+	 * sets what is the same for every frame, once per context
+	 */
+	void init() {
+		invalidate();
+		glClearDepth(1.0f);
+		glEnable(GL_LIGHT0); // single light source
+		glEnable(GL_COLOR_MATERIAL); // material colour tracks glColor
+		glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glCullFace(GL_BACK); // only cull back
+		glDepthFunc(GL_LEQUAL); // depth buffer compares =<
+		glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
+		glEnable(GL_NORMALIZE);
+	}
+	void set(Cap c, bool on) {
+		if (caps[c] == (int)on) { return; }
+		caps[c] = on;
+		if (on) { glEnable(glCap(c)); }
+		else { glDisable(glCap(c)); }
+	}
+	void shadeModel(bool s) {
+		if (smooth == (int)s) { return; }
+		smooth = s;
+		glShadeModel(s ? GL_SMOOTH : GL_FLAT);
+	}
+	/**
+	 * Camera function
+	 * perspective projection and a view circling the pyramid, with the
+	 * light placed in view space as it was when the view was set
+	 * @param w - viewport width
+	 * @param h - viewport height
+	 * @param zoom - distance from the y axis
+	 * @param yRotate - angle around the y axis, radians
+	 * @param xRotate - height of the eye
+	 * @param lightPos - light position
+	 */
+	void camera(int w, int h, double zoom, double yRotate, double xRotate, const GLfloat lightPos[4]) {
+		if (cameraKnown && w == viewWidth && h == viewHeight && zoom == camZoom && yRotate == camYRotate
+			&& xRotate == camXRotate) {
+			return;
+		}
+		cameraKnown = true;
+		viewWidth = w; viewHeight = h;
+		camZoom = zoom; camYRotate = yRotate; camXRotate = xRotate;
+		glMatrixMode(GL_PROJECTION);
+		glLoadIdentity();
+		gluPerspective(74, (double)w / (double)h, 2, 300); // taken online for square aspect (n*n)
+		glMatrixMode(GL_MODELVIEW);
+		glLoadIdentity();
+		double xCam = zoom * cos(yRotate), zCam = zoom * sin(yRotate);
+		gluLookAt(xCam, xRotate, zCam, 0, -20, 0, 0, 1, 0);
+		glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
+		GLfloat projection[16], view[16];
+		glGetFloatv(GL_PROJECTION_MATRIX, projection);
+		glGetFloatv(GL_MODELVIEW_MATRIX, view);
+		for (int c = 0; c < 4; c++) {
+			for (int r = 0; r < 4; r++) {
+				clip[c * 4 + r] = 0;
+				for (int k = 0; k < 4; k++) { clip[c * 4 + r] += projection[k * 4 + r] * view[c * 4 + k]; }
+			}
+		}
+		eye[0] = (GLfloat)xCam; eye[1] = (GLfloat)xRotate; eye[2] = (GLfloat)zCam;
+	}
+	// projection times view of the last camera set, column major
+	const GLfloat *viewProjection() const {
+		return clip;
+	}
+	const GLfloat *eyePosition() const {
+		return eye;
+	}
+	// pixels a unit at distance 1 covers on screen with the last camera
+	float pixelScale() const {
+		return (float)(0.5 * viewHeight / tan(37 * M_PI / 180)); // half the 74 degree field of view
+	}
+	/**
+	 * Overlay function
+	 * pixel coordinates for drawing text, the camera is set again
+	 * on the next call to camera()
+	 */
+	void overlay(int w, int h) {
+		set(Lighting, false);
+		set(DepthTest, false);
+		cameraKnown = false;
+		glMatrixMode(GL_PROJECTION);
+		glLoadIdentity();
+		gluOrtho2D(0, w, 0, h);
+		glMatrixMode(GL_MODELVIEW);
+		glLoadIdentity();
+	}
+};
@@ -0,0 +1,158 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "Simulation.h"
+
+/**
+ * ScenarioFile Class
+ * a parameter sweep read from a text file. each line names a setting and
+ * the values to try, and the sweep is every combination of them:
+ *   # comments run to the end of the line
+ *   steps 2000
+ *   fire 1000       # steps the cannon fires for, the rest settle
+ *   gravity 0.05 0.1 0.2
+ *   friction 0.1:0.4:0.1
+ * a value is a number, or from:to:step for every step from one to the
+ * other inclusive. yes/no stand for 1 and 0 in the switches. a setting
+ * not in the file keeps the headless default, and a later line for the
+ * same setting replaces the earlier one. runs are numbered with the last
+ * setting changing fastest
+ */
+
+class ScenarioFile {
+public:
+	enum Param { Steps, Fire, Rate, Seed, Gravity, Friction, Floors, Size, Spread, RandSpeed, Bumping, Immortal, Trail,
+		paramCount };
+	struct Run {
+		double v[paramCount];
+	};
+private:
+	std::vector<double> values[paramCount]; // the grid of each setting
+	std::string error;
+
+	// a setting's number by name, or -1
+	static int find(const char *name) {
+		for (int p = 0; p < paramCount; p++) {
+			if (strcmp(name, paramName(p)) == 0) { return p; }
+		}
+		return -1;
+	}
+	/**
+	 * Value parsing function
+	 * appends one value or range to a grid
+	 * @return false if the text is not a number, switch or range
+	 */
+	static bool parseValue(const char *text, std::vector<double> &out) {
+		if (strcmp(text, "yes") == 0 || strcmp(text, "no") == 0) {
+			out.push_back(text[0] == 'y');
+			return true;
+		}
+		char *end;
+		double from = strtod(text, &end);
+		if (end == text) { return false; }
+		if (*end == 0) {
+			out.push_back(from);
+			return true;
+		}
+		double to, step;
+		char tail;
+		if (sscanf(end, ":%lf:%lf%c", &to, &step, &tail) != 2 || !(step > 0) || to < from) { return false; }
+		long n = (long)floor((to - from) / step + 1e-9); // steps that do not drift past to
+		if (n > 100000) { return false; }
+		for (long k = 0; k <= n; k++) { out.push_back(from + k * step); } // not summed, so no rounding builds up
+		return true;
+	}
+public:
+	ScenarioFile() {
+		// as Simulation::reset and the headless driver have them, fire -1 fires every step
+		double d[paramCount] = { 1000, -1, 1, 1, 0.1, 0.2, 5, 0.25, 0.2, 0, 0, 0, 0 };
+		for (int p = 0; p < paramCount; p++) { values[p].assign(1, d[p]); }
+	}
+	// the name a setting has in a file and in the results
+	static const char *paramName(int p) {
+		static const char *names[paramCount] = { "steps", "fire", "rate", "seed", "gravity", "friction", "floors",
+			"size", "spread", "rand-speed", "bumping", "immortal", "trail" };
+		return names[p];
+	}
+	// values a setting takes
+	const std::vector<double> &grid(int p) const {
+		return values[p];
+	}
+	/**
+	 * Loading function
+	 * @param path - the scenario file
+	 * @return false if it could not be read or a line is wrong, see getError()
+	 */
+	bool load(const char *path) {
+		FILE *f = fopen(path, "r");
+		if (!f) {
+			error = std::string("could not open ") + path;
+			return false;
+		}
+		char line[4096];
+		int number = 0;
+		bool ok = true;
+		while (ok && fgets(line, sizeof(line), f)) {
+			number++;
+			char *hash = strchr(line, '#');
+			if (hash) { *hash = 0; }
+			char *save, *name = strtok_r(line, " \t\r\n", &save);
+			if (!name) { continue; }
+			int p = find(name);
+			std::vector<double> grid;
+			for (char *v; ok && p >= 0 && (v = strtok_r(0, " \t\r\n", &save));) { ok = parseValue(v, grid); }
+			if (p < 0 || !ok || grid.empty()) {
+				char where[32];
+				snprintf(where, sizeof(where), "%d", number);
+				error = std::string(path) + ":" + where + ": " + ((p < 0) ? "unknown setting " : "bad values for ") + name;
+				ok = false;
+			}
+			else { values[p] = grid; }
+		}
+		fclose(f);
+		return ok;
+	}
+	const std::string &getError() const {
+		return error;
+	}
+	// combinations in the sweep
+	size_t runs() const {
+		size_t n = 1;
+		for (int p = 0; p < paramCount; p++) { n *= values[p].size(); }
+		return n;
+	}
+	/**
+	 * Combination function
+	 * @param k - run number, below runs()
+	 */
+	Run run(size_t k) const {
+		Run r;
+		for (int p = paramCount - 1; p >= 0; p--) {
+			r.v[p] = values[p][k % values[p].size()];
+			k /= values[p].size();
+		}
+		return r;
+	}
+	/**
+	 * Setup function
+	 * configures a fresh simulation as the headless driver would for the
+	 * same options, firing from the cannon
+	 */
+	static void apply(const Run &r, Simulation &sim) {
+		sim.seed((uint64_t)r.v[Seed]);
+		sim.gravity = r.v[Gravity];
+		sim.friction = r.v[Friction];
+		sim.setFloors((int)r.v[Floors]);
+		sim.scaleFactor = (float)r.v[Size];
+		sim.spreadRandomness = r.v[Spread];
+		sim.randSpeed = r.v[RandSpeed] != 0;
+		sim.particleBumping = r.v[Bumping] != 0;
+		sim.removeParticles = r.v[Immortal] == 0;
+		sim.particles.setTrailCapacity(std::max((int)r.v[Trail], 0));
+		sim.emitters.assign(1, Emitter(sim.firePosition, (int)r.v[Rate], sim.spreadRandomness, sim.randSpeed));
+	}
+};
@@ -0,0 +1,229 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include "Simulation.h"
+
+/**
+ * SceneFile Class
+ * saves and restores the whole state of a Simulation as one binary file:
+ * a fixed header with the environment settings and the cannon's seed,
+ * the floors, the emitters, then every array of the particle record back to back,
+ * trail arena included. files are read through mmap so restoring a
+ * multi-million particle scene is a handful of large copies.
+ * the layout is native little-endian, the version is bumped whenever it
+ * changes and a file with another version or size is refused
+ */
+
+class SceneFile {
+public:
+	enum { version = 4 };
+private:
+	struct Header {
+		char magic[4]; // "PSIM"
+		uint32_t version;
+		uint64_t particles; // entries in every particle array
+		uint64_t trailFloats; // size of the trail arena
+		uint64_t freeSlots; // trail slots waiting for reuse
+		uint64_t awake; // particles not asleep, the first ones in the record
+		uint32_t floors;
+		int32_t trailCapacity;
+		double gravity, friction, spreadRandomness;
+		uint64_t randSeed;
+		float scaleFactor, firePosition[3];
+		int32_t numFloors, particleCount;
+		uint8_t particleBumping, removeParticles, randSpeed, unused[5];
+		uint64_t emitters;
+		int64_t emitSteps; // emit() calls so far, where the bursts are up to
+	};
+	static_assert(sizeof(Header) == 128, "scene header must not be padded");
+	// an emitter as stored
+	struct EmitterRecord {
+		float position[3];
+		int32_t rate, burst, burstEvery;
+		double spread;
+		uint8_t randSpeed, unused[7];
+	};
+	static_assert(sizeof(EmitterRecord) == 40, "emitter record must not be padded");
+
+	// bytes the body of a file with this header takes
+	static uint64_t bodySize(const Header &h) {
+		return (uint64_t)h.floors * 2 * sizeof(float) + h.emitters * sizeof(EmitterRecord) + h.particles * 16 * 4
+			+ h.trailFloats * sizeof(float) + h.freeSlots * sizeof(int32_t);
+	}
+	template <class T>
+	static bool write(FILE *f, const std::vector<T> &v) {
+		return v.empty() || fwrite(v.data(), sizeof(T), v.size(), f) == v.size();
+	}
+	/**
+	 * Checking function
+	 * whether a file's counts fit its size, its floor count matches the
+	 * floors it holds, every colour is one of the three the palettes have
+	 * and every trail index lands inside its arena, so restoring it cannot
+	 * index out of range
+	 * @param h - the file's header
+	 * @param body - the mapped file past the header
+	 * @param bytes - size of the whole file
+	 */
+	static bool valid(const Header &h, const char *body, uint64_t bytes) {
+		uint64_t counts[5] = { h.floors, h.emitters, h.particles, h.trailFloats, h.freeSlots };
+		for (int c = 0; c < 5; c++) {
+			if (counts[c] > bytes) { return false; } // bodySize could wrap
+		}
+		if (sizeof(Header) + bodySize(h) != bytes || h.awake > h.particles || h.trailCapacity < 0) { return false; }
+		if (h.numFloors < 0 || h.numFloors > 10 || (uint64_t)h.numFloors != h.floors) { return false; }
+		uint64_t cap = h.trailCapacity, slots = cap ? h.trailFloats / (cap * 3) : 0;
+		if (cap ? h.trailFloats % (cap * 3) != 0 : (h.trailFloats != 0 || h.freeSlots != 0)) { return false; }
+		const int32_t *color = (const int32_t*)(body + (uint64_t)h.floors * 2 * sizeof(float)
+			+ h.emitters * sizeof(EmitterRecord) + h.particles * 9 * 4); // after x, y, z, dx, dy, dz, size, speed, life
+		const int32_t *slot = color + h.particles * 4; // after color, lineDivisor, id, buffer
+		const int32_t *head = slot + h.particles, *length = head + h.particles;
+		const int32_t *freeSlot = (const int32_t*)((const float*)(length + h.particles) + h.trailFloats);
+		for (uint64_t i = 0; i < h.particles; i++) {
+			if (color[i] < 0 || color[i] > 2) { return false; }
+			if (length[i] < 0 || (uint64_t)length[i] > cap) { return false; }
+			if (cap && (slot[i] < 0 || (uint64_t)slot[i] >= slots || head[i] < 0 || (uint64_t)head[i] >= cap)) { return false; }
+		}
+		for (uint64_t i = 0; i < h.freeSlots; i++) {
+			if (freeSlot[i] < 0 || (uint64_t)freeSlot[i] >= slots) { return false; }
+		}
+		return true;
+	}
+	// copies n values out of the mapped file and moves past them
+	template <class T>
+	static void read(const char *&at, std::vector<T> &v, size_t n) {
+		v.assign((const T*)at, (const T*)at + n);
+		at += n * sizeof(T);
+	}
+public:
+	/**
+	 * Scene saving function
+	 * the particles have to be in the full record, a compact simulation
+	 * holds none there and is refused, unpack it with setCompact(false)
+	 * @param sim - the simulation to save
+	 * @param path - file to write, replaced if it exists
+	 * @return false if the file could not be written or sim is compact
+	 */
+	static bool save(const Simulation &sim, const char *path) {
+		if (sim.isCompact()) { return false; }
+		const ParticleStore &ps = sim.particles;
+		Header h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, "PSIM", 4);
+		h.version = version;
+		h.particles = ps.count();
+		h.trailFloats = ps.trailPoints.size();
+		h.freeSlots = ps.freeSlots.size();
+		h.awake = sim.sleepersValid() ? ps.awake : ps.alive(); // the next step would wake them
+		h.floors = (uint32_t)sim.listFloors.size();
+		h.trailCapacity = ps.trailCapacity;
+		h.gravity = sim.gravity; h.friction = sim.friction; h.spreadRandomness = sim.spreadRandomness;
+		h.scaleFactor = sim.scaleFactor;
+		memcpy(h.firePosition, sim.firePosition, sizeof(h.firePosition));
+		h.numFloors = sim.numFloors; h.particleCount = sim.particleCount;
+		h.randSeed = sim.randSeed;
+		h.particleBumping = sim.particleBumping; h.removeParticles = sim.removeParticles; h.randSpeed = sim.randSpeed;
+		h.emitters = sim.emitters.size();
+		h.emitSteps = sim.emitSteps;
+		std::vector<float> floors;
+		for (std::list<Floor>::const_iterator f = sim.listFloors.begin(); f != sim.listFloors.end(); ++f) {
+			floors.push_back(f->getPos());
+			floors.push_back(f->getSize());
+		}
+		std::vector<EmitterRecord> emitters(sim.emitters.size());
+		for (size_t e = 0; e < emitters.size(); e++) {
+			const Emitter &m = sim.emitters[e];
+			EmitterRecord &r = emitters[e];
+			memset(&r, 0, sizeof(r));
+			memcpy(r.position, m.position, sizeof(r.position));
+			r.rate = m.rate; r.burst = m.burst; r.burstEvery = m.burstEvery;
+			r.spread = m.spread;
+			r.randSpeed = m.randSpeed;
+		}
+		FILE *f = fopen(path, "wb");
+		if (!f) { return false; }
+		bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && write(f, floors) && write(f, emitters)
+			&& write(f, ps.x) && write(f, ps.y) && write(f, ps.z)
+			&& write(f, ps.dx) && write(f, ps.dy) && write(f, ps.dz)
+			&& write(f, ps.size) && write(f, ps.speed) && write(f, ps.life) && write(f, ps.color)
+			&& write(f, ps.lineDivisor) && write(f, ps.id) && write(f, ps.buffer)
+			&& write(f, ps.trailSlot) && write(f, ps.trailHead) && write(f, ps.trailLength)
+			&& write(f, ps.trailPoints) && write(f, ps.freeSlots);
+		return (fclose(f) == 0) && ok;
+	}
+	/**
+	 * Scene loading function
+	 * replaces the scene of sim with the one in the file, the thread
+	 * count and step kernel are left as they are. a compact sim drops
+	 * its packed particles and leaves compact mode
+	 * @param sim - the simulation to restore into
+	 * @param path - file to read
+	 * @return false if the file is missing, truncated, another version or
+	 * holds a trail index, colour or floor count out of range, in which
+	 * case sim is untouched
+	 */
+	static bool load(Simulation &sim, const char *path) {
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) { return false; }
+		struct stat st;
+		if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+			close(fd);
+			return false;
+		}
+		void *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd); // the mapping stays valid
+		if (map == MAP_FAILED) { return false; }
+		madvise(map, st.st_size, MADV_SEQUENTIAL);
+		Header h;
+		memcpy(&h, map, sizeof(h));
+		if (memcmp(h.magic, "PSIM", 4) != 0 || h.version != version
+			|| !valid(h, (const char*)map + sizeof(Header), st.st_size)) {
+			munmap(map, st.st_size);
+			return false;
+		}
+		sim.compact = CompactStore(); // the loaded particles replace the packed ones,
+		sim.setCompact(false); // so leaving compact mode has nothing to unpack
+		const char *at = (const char*)map + sizeof(Header);
+		std::vector<float> floors;
+		read(at, floors, h.floors * 2);
+		sim.listFloors.clear();
+		for (size_t i = 0; i < floors.size(); i += 2) { sim.listFloors.push_back(Floor(floors[i], floors[i + 1])); }
+		std::vector<EmitterRecord> emitters;
+		read(at, emitters, h.emitters);
+		sim.emitters.clear();
+		for (size_t e = 0; e < emitters.size(); e++) {
+			const EmitterRecord &r = emitters[e];
+			sim.emitters.push_back(Emitter(r.position, r.rate, r.spread, r.randSpeed != 0));
+			sim.emitters.back().setBurst(r.burst, r.burstEvery);
+		}
+		sim.emitSteps = h.emitSteps;
+		ParticleStore &ps = sim.particles;
+		size_t n = h.particles;
+		read(at, ps.x, n); read(at, ps.y, n); read(at, ps.z, n);
+		read(at, ps.dx, n); read(at, ps.dy, n); read(at, ps.dz, n);
+		read(at, ps.size, n); read(at, ps.speed, n); read(at, ps.life, n); read(at, ps.color, n);
+		read(at, ps.lineDivisor, n); read(at, ps.id, n); read(at, ps.buffer, n);
+		read(at, ps.trailSlot, n); read(at, ps.trailHead, n); read(at, ps.trailLength, n);
+		read(at, ps.trailPoints, h.trailFloats);
+		read(at, ps.freeSlots, h.freeSlots);
+		ps.trailCapacity = h.trailCapacity;
+		ps.awake = h.awake;
+		ps.retireDead();
+		ps.reshuffles++;
+		sim.gravity = h.gravity; sim.friction = h.friction; sim.spreadRandomness = h.spreadRandomness;
+		sim.scaleFactor = h.scaleFactor;
+		memcpy(sim.firePosition, h.firePosition, sizeof(h.firePosition));
+		sim.numFloors = h.numFloors; sim.particleCount = h.particleCount;
+		sim.randSeed = h.randSeed;
+		sim.particleBumping = h.particleBumping != 0; sim.removeParticles = h.removeParticles != 0;
+		sim.randSpeed = h.randSpeed != 0;
+		sim.keepSleepers();
+		munmap(map, st.st_size);
+		return true;
+	}
+};
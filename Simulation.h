@@ -0,0 +1,644 @@
+#pragma once
+#include <math.h>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include "ParticleStore.h"
+#include "CompactStore.h"
+#include "SpatialGrid.h"
+#include "ThreadPool.h"
+#include "StepKernel.h"
+#include "FloorIndex.h"
+#include "Profiler.h"
+#include "Emitter.h"
+#include "Floor.h"
+
+/**
+ * Simulation Class
+ * the physics of the scene with no dependency on GLUT or OpenGL:
+ * environment settings, the particle record, the pyramid floors
+ * and the step that moves, bounces, collides and removes particles.
+ * the interactive program renders one of these, the headless
+ * program just steps it. the step can be split across a thread pool,
+ * every particle only writes its own slot so the result is the same
+ * for any number of threads. movement and floor collision go through
+ * the vectorized StepKernel.
+ * a particle that has come to rest on a floor can never move again, its
+ * speed is zero and only a yellow particle is deflected by another.
+ * such particles are put to sleep: the step skips them and, while
+ * particles are removed, only counts their life down. they still
+ * deflect others. a change of floors or of removeParticles wakes all.
+ * the movement loop is compiled once for every combination of floors,
+ * trails and removal, and the step picks the one for the current
+ * settings, so no feature is tested per particle.
+ * for runs of many millions the particles can be kept quantized in a
+ * CompactStore instead, in 27 bytes a particle. particles are still
+ * fired into the full record and packed at the next step. the compact
+ * step has no collision, trails or sleeping
+ */
+
+class Simulation {
+public:
+	// particle properties
+	float scaleFactor; // size of particle
+	bool particleBumping; // collision on/off?
+	// environment properties
+	double gravity;
+	double friction;
+	int numFloors;
+	bool removeParticles; // remove dead particles?
+	int particleCount;
+	float firePosition[3]; // cannon position
+	// cannon properties
+	double spreadRandomness; // randomness of stream
+	bool randSpeed; // random velocity of particle?
+	uint64_t randSeed; // every particle's spread and speed follow from this and its id
+	std::vector<Emitter> emitters; // sources fired by emit(), besides the cannon
+	long emitSteps; // emit() calls so far, times the bursts
+	bool sleeping; // put resting particles to sleep?
+	bool specialized; // move through the loop compiled for the current features?
+	double deadFraction; // share of the record that may be dead before it is compacted
+
+	ParticleStore particles;
+	CompactStore compact; // the particles while compacting, see setCompact
+	std::list<Floor> listFloors;
+	StepKernel kernel; // movement and floor collision, vectorized
+
+	Simulation() {
+		particleCount = 0;
+		randSeed = 1;
+		emitSteps = 0;
+		sleeping = true;
+		specialized = true;
+		deadFraction = 0.125;
+		compacting = false;
+		startKept = false;
+		firePosition[1] = 15;
+		setThreads(1);
+		reset();
+		keepSleepers();
+	}
+	/**
+	 * Function to resize the thread pool used by the step
+	 * @param n - number of threads, 1 steps on the calling thread only
+	 */
+	void setThreads(int n) {
+		pool.reset(); // join the old workers first
+		pool.reset(new ThreadPool(std::max(n, 1)));
+		contactBuffers.assign(pool->size(), std::vector<int>());
+		deaths.assign(pool->size(), 0);
+		compactBatches.assign(pool->size(), CompactStore::Batch());
+	}
+	int getThreads() const {
+		return pool->size();
+	}
+	/**
+	 * Function to seed the cannon, the same seed fires the same stream
+	 */
+	void seed(uint64_t s) {
+		randSeed = s;
+	}
+	/**
+	 * Function to reset environment variables to defaults
+	 * clears the scene and rebuilds the default five floors
+	 */
+	void reset() {
+		scaleFactor = 0.25; gravity = 0.1; friction = 0.2;
+		spreadRandomness = 0.2; removeParticles = true;
+		randSpeed = false; particleBumping = false;
+		particles.clear(); compact.clear(); listFloors.clear();
+		firePosition[0] = 0; firePosition[2] = 0; numFloors = 5; addFloor(5);
+		floorIndex.build(listFloors);
+	}
+	/**
+	 * Capacity function
+	 * makes room for n particles in the record and the step's scratch
+	 * space, so the step never allocates while the count stays below n.
+	 * the record also holds the dead waiting to be removed, up to
+	 * deadFraction of it, and there is room for them too
+	 */
+	void reserve(size_t n) {
+		size_t room = (size_t)(n / (1 - std::min(std::max(deadFraction, 0.0), 0.99))) + 1;
+		particles.reserve(room);
+		moved.reserve(room); hit.reserve(room);
+		grid.reserve(2 * room); // a moved magenta particle is bucketed twice
+		magentaStart.reserve(room); candidates.reserve(2 * room);
+		queries.reserve(room); tasks.reserve(room + 1); contactRuns.reserve(room);
+	}
+	/**
+	 * Particle Creation function
+	 * creates a new Particle for the environment
+	 */
+	void addParticle() {
+		particles.add(firePosition, spreadRandomness, scaleFactor, ++particleCount, randSpeed, randSeed);
+	}
+	/**
+	 * Particle Batch Creation function
+	 * fires n particles from an emitter in one append to the record
+	 */
+	void addParticles(const Emitter &e, int n) {
+		if (n <= 0) { return; }
+		particles.addBatch(e.position, e.spread, scaleFactor, particleCount + 1, n, e.randSpeed, randSeed);
+		particleCount += n;
+	}
+	/**
+	 * Emission function
+	 * fires one step's batch from every emitter, in list order
+	 */
+	void emit() {
+		for (size_t e = 0; e < emitters.size(); e++) {
+			addParticles(emitters[e], emitters[e].batchSize(emitSteps));
+		}
+		emitSteps++;
+	}
+	/**
+	 * Function to generate pyramid floors for environment
+	 * this creates five floors for the pyramid with params
+	 * -15,25, -12.5,20, -10,15, -7.5,10, -5,5 by default
+	 */
+	void addFloor(int k) {
+		for (double i = -5.0, j = 5.0; k != 0; i -= 2.5, j += 5, k--) {
+			listFloors.push_back(Floor(i, j));
+		}
+	}
+	/**
+	 * Function to rebuild the pyramid with a given number of floors
+	 * @param k - number of floors, clamped to 0..10
+	 */
+	void setFloors(int k) {
+		listFloors.clear();
+		addFloor(numFloors = std::min(std::max(k, 0), 10));
+		floorIndex.build(listFloors);
+	}
+	/**
+	 * Contact finding function
+	 * only yellow particles are deflected, and only by magenta ones, which
+	 * are the particles bucketed in the grid. p meets each of those as
+	 * it was when p took its turn in id order: moved if it comes before
+	 * p, not yet moved if it comes after. nothing is written but the
+	 * contact list, so particles can be tested concurrently
+	 * @param hits - contact list, the grid entries p hit are appended in id order
+	 * @return number of particles tested against p
+	 */
+	size_t findContacts(size_t p, std::vector<int> &hits) const {
+		/**
+		 * p = source particle, what to check against
+		 * q = particles in neighbouring cells
+		 */
+		size_t first = hits.size(), tests = 0;
+		float px = particles.x[p], py = particles.y[p], pz = particles.z[p], ps = particles.size[p];
+		int pid = particles.id[p];
+		auto narrowPhase = [&](int e, const SpatialGrid::Entry &q) {
+			if (q.id != pid // if not source particle
+				&& (q.seen == SpatialGrid::ByAll || (q.seen == SpatialGrid::ByHigherIds) == (pid > q.id))) {
+				tests++;
+				/**
+				 * euclidean distance, etc
+				 */
+				double x = (double)q.x - (double)px;
+				double y = (double)q.y - (double)py;
+				double z = (double)q.z - (double)pz;
+				double d = sqrt(x * x + y * y + z * z);
+				if (d <= ((ps * 5) + (q.size * 5))) {
+					hits.push_back(e);
+				}
+			}
+		};
+		grid.query(px, py, pz, narrowPhase);
+		// in id order, as the original scan met them
+		std::sort(hits.begin() + first, hits.end(), [&](int a, int b) { return grid.entry(a).id < grid.entry(b).id; });
+		return tests;
+	}
+	/**
+	 * Contact response function
+	 * bounces p off each particle it touched, in the order given, where
+	 * p met it. the buffer debounce counts every contact, so the order
+	 * matters. only p is written
+	 * @param hits - the grid entries p touched
+	 * @param n - number of them
+	 */
+	void applyContacts(size_t p, const int *hits, int n) {
+		for (int h = 0; h < n; h++) {
+			const SpatialGrid::Entry &q = grid.entry(hits[h]);
+			/**
+			 * change direction if collision along x or z plane
+			 * change in speed if collision along y plane
+			 */
+			bool bounceX = (particles.x[p] > q.x);
+			bool bounceY = (particles.y[p] > q.y);
+			bool bounceZ = (particles.z[p] > q.z);
+			particles.changeDirection(p, bounceX, bounceZ, bounceY);
+		}
+	}
+	/**
+	 * Particle Movement function for a range of the record
+	 * the kernel moves the particles and bounces them off the floors,
+	 * then the per-particle bookkeeping runs here, testing every feature
+	 * as it goes. the specialized loops below must end the same
+	 * @param lf - the lowest floor of the pyramid
+	 * @return particles whose life ran out
+	 */
+	size_t moveRangeChecked(size_t begin, size_t end, float lf) {
+		kernel.integrate(particles, begin, end, gravity, moved.data()); // move with regards to gravity
+		for (size_t p = begin; p < end; p++) {
+			if (moved[p]) { particles.recordPath(p); }
+		}
+		/**
+		 * The kernel stores the position a floor collision
+		 * occurs at for every particle, or zero if none did,
+		 * and has already applied friction to the ones that hit
+		 */
+		kernel.floors(particles, begin, end, floorIndex, friction, hit.data());
+		size_t died = 0;
+		if (numFloors != 0) { // if floors exist
+			size_t bounces = 0;
+			for (size_t p = begin; p < end; p++) {
+				int was = particles.life[p];
+				if (hit[p] != 0) { // if hit a floor
+					bounces++;
+					// change color status to indicate >0 bounces
+					if (particles.color[p] == 0) { particles.changeColor(p); }
+					if (particles.checkDead(p, gravity)) { // if particle is dead/dying
+						// change color status to indicate dying
+						if (particles.color[p] == 1) { particles.changeColor(p); }
+					}
+				}
+				// check if particle off "killplane"
+				particles.checkOffPyramid(p, removeParticles, lf);
+				if (was > 0 && particles.life[p] <= 0) { died++; }
+			}
+			PROFILE_COUNT(Bounces, bounces);
+		}
+		return died;
+	}
+	/**
+	 * Particle Movement function for a range, for one set of features
+	 * Floors - there are floors to land on
+	 * Paths - trails are kept
+	 * Remove - particles at rest lose life
+	 * without trails or floors whole passes drop out, and the rest are
+	 * loops of selects the compiler can vectorize
+	 * @param lf - the lowest floor of the pyramid
+	 * @return particles whose life ran out
+	 */
+	template <bool Floors, bool Paths, bool Remove>
+	size_t moveRange(size_t begin, size_t end, float lf) {
+		kernel.integrate(particles, begin, end, gravity, moved.data());
+		if (Paths) {
+			for (size_t p = begin; p < end; p++) {
+				if (moved[p]) { particles.recordPath(p); }
+			}
+		}
+		else { particles.countDivisors(begin, end, moved.data()); }
+		if (!Floors) { // nothing to hit, nothing lands or dies
+			std::fill(hit.begin() + begin, hit.begin() + end, 0.0f);
+			return 0;
+		}
+		kernel.floors(particles, begin, end, floorIndex, friction, hit.data());
+		size_t died;
+		size_t bounces = particles.land<Remove>(begin, end, hit.data(), gravity, lf, died);
+		PROFILE_COUNT(Bounces, bounces);
+		return died;
+	}
+	typedef size_t (Simulation::*MoveFunction)(size_t, size_t, float);
+	// the movement loop for the current settings
+	MoveFunction moveFunction() const {
+		static const MoveFunction variants[8] = {
+			&Simulation::moveRange<false, false, false>, &Simulation::moveRange<false, false, true>,
+			&Simulation::moveRange<false, true, false>, &Simulation::moveRange<false, true, true>,
+			&Simulation::moveRange<true, false, false>, &Simulation::moveRange<true, false, true>,
+			&Simulation::moveRange<true, true, false>, &Simulation::moveRange<true, true, true>
+		};
+		if (!specialized) { return &Simulation::moveRangeChecked; }
+		return variants[(numFloors != 0) * 4 + (particles.trailCapacity > 0) * 2 + removeParticles];
+	}
+	/**
+	 * Particle Movement Function
+	 * For each particle in the record, move it based on
+	 * environment variables like friction, gravity, etc
+	 * then collide particles against each other once all have moved
+	 */
+	void moveParticles() {
+		if (!sleepersValid()) {
+			particles.wakeAll(); // sleepers were put to sleep under other rules
+			keepSleepers();
+		}
+		float lf = floorIndex.getKillPlane();
+		moved.resize(particles.awake);
+		hit.resize(particles.awake);
+		moving = moveFunction(); // picked once per step, not per particle
+		if (particleBumping) { keepMagentaStart(); }
+		{
+			PROFILE_SCOPE(Move);
+			std::fill(deaths.begin(), deaths.end(), 0);
+			pool->parallelFor(particles.awake, 1024, [&](size_t begin, size_t end, int worker) {
+				deaths[worker] += (this->*moving)(begin, end, lf);
+			});
+			// all a sleeper does is die slowly, as checkOffPyramid would have it
+			if (removeParticles) {
+				for (size_t p = particles.awake; p < particles.count() - particles.dead; p++) {
+					deaths[0] += (particles.life[p]-- == 1);
+				}
+			}
+		}
+		// perform interparticle collision if flag set
+		if (particleBumping) { collideParticles(); }
+		size_t died = 0;
+		for (size_t w = 0; w < deaths.size(); w++) { died += deaths[w]; }
+		if (died > 0) { retireDead(died); }
+		if (sleeping) { settle(lf); }
+	}
+	/**
+	 * Retiring function
+	 * moves the particles that died this step to the dead end of the
+	 * record, after collision, which still sees them as the step began.
+	 * the scan stops at the last of them
+	 * @param died - particles whose life ran out this step
+	 */
+	void retireDead(size_t died) {
+		for (size_t p = 0; died > 0 && p < particles.count() - particles.dead;) {
+			if (particles.life[p] > 0) {
+				p++;
+				continue;
+			}
+			if (p < particles.awake) { hit[p] = hit[particles.awake - 1]; } // the last awake particle moves into p
+			particles.retire(p);
+			died--;
+		}
+	}
+	// whether the sleepers were put to sleep under the current floors and rules
+	bool sleepersValid() const {
+		return sleeping && floorIndex.matches(listFloors) && floorIndex.getGeneration() == sleptGeneration
+			&& removeParticles == sleptRemoving && numFloors == sleptFloors;
+	}
+	/**
+	 * Function which takes the sleepers as they are for the current
+	 * floors and rules, for a record restored from a scene file
+	 */
+	void keepSleepers() {
+		floorIndex.build(listFloors);
+		sleptGeneration = floorIndex.getGeneration();
+		sleptRemoving = removeParticles;
+		sleptFloors = numFloors;
+	}
+	/**
+	 * Sleeping function
+	 * puts to sleep every awake particle that has stopped on a floor: no
+	 * speed, no floor hit this step so it did not move, and magenta.
+	 * while particles are not removed it must also be above the kill
+	 * plane, where a sleeper never changes at all
+	 * @param lf - the lowest floor of the pyramid
+	 */
+	void settle(float lf) {
+		if (numFloors == 0) { return; } // nothing comes to rest
+		for (size_t p = 0; p < particles.awake;) {
+			if (particles.speed[p] == 0 && hit[p] == 0 && particles.color[p] == 2
+				&& (removeParticles || !(particles.y[p] < lf))) {
+				hit[p] = hit[particles.awake - 1]; // the last awake particle moves into p
+				particles.sleep(p);
+			}
+			else { p++; }
+		}
+	}
+	/**
+	 * Function which notes where the awake magenta particles are before
+	 * they move, for the yellow particles that take their turn first.
+	 * sleepers do not move and so are not noted
+	 */
+	void keepMagentaStart() {
+		magentaStart.clear();
+		for (size_t p = 0; p < particles.awake; p++) {
+			if (particles.color[p] == 2) {
+				MagentaStart m = { (int)p, particles.x[p], particles.y[p], particles.z[p] };
+				magentaStart.push_back(m);
+			}
+		}
+		startKept = true;
+	}
+	/**
+	 * Candidate bucketing function
+	 * puts every live magenta particle in the grid as the yellow ones
+	 * meet it. the original scan moved and collided one particle at a
+	 * time in id order, so a particle that moved this step is met where
+	 * it is now by higher ids and where it was by lower ids, and one that
+	 * turned magenta this step only by higher ids. without a kept start
+	 * everything is met where it is now
+	 */
+	void bucketCandidates() {
+		float maxSize = 0;
+		for (size_t p = 0; p < particles.alive(); p++) { maxSize = std::max(maxSize, particles.size[p]); }
+		candidates.clear();
+		size_t k = 0;
+		for (size_t p = 0; p < particles.alive(); p++) { // the dead of this step were still there to be hit
+			while (k < magentaStart.size() && magentaStart[k].slot < (int)p) { k++; }
+			if (particles.color[p] != 2) { continue; }
+			SpatialGrid::Entry e = { particles.x[p], particles.y[p], particles.z[p], particles.size[p],
+				(int)p, particles.id[p], SpatialGrid::ByAll };
+			if (startKept && p < particles.awake) {
+				bool wasMagenta = (k < magentaStart.size() && magentaStart[k].slot == (int)p);
+				if (!wasMagenta) { e.seen = SpatialGrid::ByHigherIds; }
+				else if (e.x != magentaStart[k].x || e.y != magentaStart[k].y || e.z != magentaStart[k].z) {
+					e.seen = SpatialGrid::ByHigherIds;
+					SpatialGrid::Entry before = e;
+					before.x = magentaStart[k].x; before.y = magentaStart[k].y; before.z = magentaStart[k].z;
+					before.seen = SpatialGrid::ByLowerIds;
+					candidates.push_back(before);
+				}
+			}
+			candidates.push_back(e);
+		}
+		// cells one collision diameter wide, padded against rounding
+		grid.build(candidates, 10 * maxSize * 1.0001f);
+	}
+	/**
+	 * Interparticle Collision pass
+	 * rebuilds the broad phase, then collides in two phases. first the
+	 * yellow particles are grouped by the cell they sit in, and the
+	 * groups are searched for contacts by work stealing, so a dense pile
+	 * filling a few cells is shared out as the threads run dry. then
+	 * every yellow particle takes its bounces from its own contact list.
+	 * the lists do not depend on which thread found them, so neither
+	 * does the result, and it is the one the original scan gave, each
+	 * particle colliding straight after it moved
+	 */
+	void collideParticles() {
+		PROFILE_SCOPE(Collide);
+		bucketCandidates();
+		queries.clear();
+		for (size_t p = 0; p < particles.awake; p++) { // sleepers are never yellow
+			if (particles.color[p] == 1) {
+				queries.push_back(((uint64_t)grid.bucket(particles.x[p], particles.y[p], particles.z[p]) << 32) | p);
+			}
+		}
+		std::sort(queries.begin(), queries.end()); // by bucket, then record order
+		tasks.clear();
+		for (size_t k = 0; k < queries.size(); k++) { // a task per bucket, crowded ones split
+			if (k == 0 || (queries[k] >> 32) != (queries[k - 1] >> 32) || k - tasks.back() == queriesPerTask) {
+				tasks.push_back(k);
+			}
+		}
+		tasks.push_back(queries.size());
+		contactRuns.resize(queries.size());
+		for (size_t w = 0; w < contactBuffers.size(); w++) { contactBuffers[w].clear(); }
+		pool->stealingFor(tasks.size() - 1, [&](size_t t, size_t, int worker) {
+			std::vector<int> &contacts = contactBuffers[worker];
+			size_t tests = 0, hits = 0;
+			for (size_t k = tasks[t]; k < tasks[t + 1]; k++) {
+				ContactRun &run = contactRuns[k];
+				run.worker = worker;
+				run.begin = contacts.size();
+				tests += findContacts((uint32_t)queries[k], contacts);
+				run.count = (int)(contacts.size() - run.begin);
+				hits += run.count;
+			}
+			PROFILE_COUNT(CollisionTests, tests);
+			PROFILE_COUNT(CollisionHits, hits);
+		});
+		pool->parallelFor(queries.size(), 256, [&](size_t begin, size_t end, int) {
+			for (size_t k = begin; k < end; k++) {
+				const ContactRun &run = contactRuns[k];
+				applyContacts((uint32_t)queries[k], contactBuffers[run.worker].data() + run.begin, run.count);
+			}
+		});
+		startKept = false;
+	}
+	/**
+	 * Function to remove particles from record
+	 * the step retires particles to the end of the record as their life
+	 * runs out, and that end is only cut off once more than deadFraction
+	 * of the record is dead. until then the dead are not moved, take no
+	 * part in collision and are not drawn
+	 */
+	void removeRecord() {
+		if (particles.dead == 0 || particles.dead <= deadFraction * particles.count()) { return; }
+		PROFILE_SCOPE(Remove);
+		size_t removed = particles.removeDead();
+		PROFILE_COUNT(Removals, removed);
+	}
+	/**
+	 * Compact mode function
+	 * packs every particle into the compact record, or unpacks them back.
+	 * packing drops trails and fits the record's box around the floors,
+	 * the cannon, the emitters and the kill plane, with 10 units to spare.
+	 * a bounce loses speed, so no particle climbs higher than its spawn
+	 * speed would carry it, and the box reaches that high. the compact
+	 * step has neither bumping nor trails, so a simulation with either is
+	 * left as it is. keep both off until the particles are unpacked
+	 * @param on - whether to keep the particles compact
+	 * @return false if bumping or a trail capacity is set, nothing is packed
+	 */
+	bool setCompact(bool on) {
+		if (on == compacting) { return true; }
+		if (on && (particleBumping || particles.trailCapacity > 0)) { return false; }
+		compacting = on;
+		if (on) {
+			floorIndex.build(listFloors);
+			float lo[3], hi[3], reach = 0;
+			for (std::list<Floor>::iterator f = listFloors.begin(); f != listFloors.end(); ++f) {
+				reach = std::max(reach, (float)f->getSize());
+			}
+			lo[1] = std::min(floorIndex.getKillPlane(), firePosition[1]);
+			hi[1] = firePosition[1];
+			for (int a = 0; a < 3; a += 2) { reach = std::max(reach, fabsf(firePosition[a])); }
+			for (size_t e = 0; e < emitters.size(); e++) {
+				for (int a = 0; a < 3; a += 2) { reach = std::max(reach, fabsf(emitters[e].position[a])); }
+				lo[1] = std::min(lo[1], emitters[e].position[1]);
+				hi[1] = std::max(hi[1], emitters[e].position[1]);
+			}
+			lo[0] = lo[2] = -reach - 10; hi[0] = hi[2] = reach + 10;
+			double climb = (gravity > 0) ? 3 * 3 / (2 * gravity) : 1000; // spawn speeds are under 3
+			lo[1] -= 10; hi[1] += 10 + (float)std::min(climb, 1000.0);
+			compact.clear();
+			compact.setBounds(lo, hi);
+			packFired();
+			particles = ParticleStore(); // gives the memory back
+		}
+		else {
+			particles = ParticleStore();
+			compact.unpack(particles);
+			compact = CompactStore();
+			keepSleepers();
+		}
+		return true;
+	}
+	bool isCompact() const {
+		return compacting;
+	}
+	// particles alive in the scene, compact or not
+	size_t liveCount() const {
+		return particles.alive() + compact.count();
+	}
+	/**
+	 * Function which packs the particles fired into the full record since
+	 * the last compact step
+	 */
+	void packFired() {
+		compact.append(particles, 0, particles.count());
+		particles.clear();
+	}
+	/**
+	 * Compact step function
+	 * moves and bounces the compact record and drops its dead
+	 */
+	void stepCompact() {
+		packFired();
+		floorIndex.build(listFloors); // the floors may have been edited
+		{
+			PROFILE_SCOPE(Move);
+			pool->parallelFor(compact.count(), 4096, [&](size_t begin, size_t end, int worker) {
+				size_t bounces = compact.step(begin, end, gravity, friction, floorIndex, kernel, numFloors != 0,
+					removeParticles, compactBatches[worker]);
+				PROFILE_COUNT(Bounces, bounces);
+			});
+		}
+		PROFILE_SCOPE(Remove);
+		size_t removed = compact.removeDead();
+		PROFILE_COUNT(Removals, removed);
+	}
+	/**
+	 * One physics step, movement then removal of the dead
+	 */
+	void step() {
+		{
+			PROFILE_SCOPE(Step);
+			if (compacting) { stepCompact(); }
+			else {
+				moveParticles();
+				removeRecord();
+			}
+		}
+		PROFILE_END_STEP();
+	}
+private:
+	SpatialGrid grid; // broad phase for interparticle collision
+	std::unique_ptr<ThreadPool> pool; // threads the step is split across
+	// where one yellow particle's contacts were put
+	struct ContactRun {
+		int worker, count;
+		size_t begin;
+	};
+	enum { queriesPerTask = 32 }; // yellow particles searched per stolen task at most
+	// where an awake magenta particle was before this step moved it
+	struct MagentaStart {
+		int slot;
+		float x, y, z;
+	};
+	std::vector<MagentaStart> magentaStart; // by slot
+	bool startKept; // magentaStart is of this step
+	std::vector<SpatialGrid::Entry> candidates; // what the grid is built from
+	std::vector<uint64_t> queries; // yellow particles, bucket in the high half and index in the low
+	std::vector<size_t> tasks; // first query of each task, then the end
+	std::vector<ContactRun> contactRuns; // by query
+	std::vector<std::vector<int> > contactBuffers; // contacts found, one list per thread
+	std::vector<size_t> deaths; // particles that died this step, per thread
+	std::vector<CompactStore::Batch> compactBatches; // what the compact step decodes into, per thread
+	FloorIndex floorIndex; // floors compiled for the kernel
+	std::vector<unsigned char> moved; // which particles moved this step
+	std::vector<float> hit; // floor each particle hit this step
+	bool compacting; // particles are in the compact record
+	MoveFunction moving; // movement loop of this step, a member so the loop body fits in a std::function
+	bool sleptRemoving; // removeParticles when the sleepers were put to sleep
+	int sleptFloors; // numFloors then
+	unsigned int sleptGeneration; // floor index then
+};
\ No newline at end of file
@@ -1,11 +1,22 @@
+// these ask gl.h for the entry points past GL 1.1, so they come before glut
+#include "FloorMesh.h"
+#ifdef USE_EGL
+#include "Offscreen.h"
+#include "FrameCapture.h"
+#endif
 #include <GL/freeglut.h>
 #include <time.h>
+#include <string.h>
 #include <list>
 #include <math.h>
 #include <iostream>
-#include "Particle.h"
-#include "Floor.h"
-#include "Line.h"
+#include <thread>
+#include <chrono>
+#include "Simulation.h"
+#include "PhysicsLoop.h"
+#include "SceneFile.h"
+#include "ParticleBatch.h"
+#include "RenderState.h"
 
 using namespace std;
 
@@ -18,20 +29,16 @@ int xRotate = 25;
 int zoom = 50;
 
 // particle properties
-float scaleFactor = 0.25; // size of particle
 int appType = 3; // appearance of the particles
 bool particlePaths = false; // draw paths?
-bool particleBumping = false; // collision on/off?
+int trailLength = 64; // points kept per path
+const char *scenePath = "scene.psim"; // where 'S' saves and 'L' loads
 // colors for particles
 int cArr[3][3] = { {0, 162, 211}, {250, 224, 20}, {224, 8, 133} };
 
-// environment properties
-double gravity = 0.1;
-double friction = 0.2;
-int numFloors = 5;
-bool removeParticles = true; // remove dead particles?
-int particleCount = 0;
-float firePosition[3] = { 0,15,0 }; // cannon position
+// environment properties, physics settings live in the simulation
+Simulation sim;
+PhysicsLoop physics(sim); // steps the simulation on a fixed timestep
 // light is positioned in a corner of the environment
 GLfloat lightSource[] = { 150.0, 150.0, 150.0, 0.0 }; // light position
 GLfloat light[] = { 1.0, 1.0, 1.0, 1.0 }; // light color
@@ -40,259 +47,183 @@ GLfloat light[] = { 1.0, 1.0, 1.0, 1.0 }; // light color
 bool shadeMode = true; // flat or smooth?
 bool useLight = true; // light on/off?
 bool useCull = false; // use culling?
-bool animationPause = false; // pause animation?
+bool batchRender = true; // vertex array batches or one glut shape per particle?
+bool offscreen = false; // drawing without a window, glut is never initialized
+#ifdef USE_EGL
+FrameCapture capture; // frames read back while drawing offscreen
+#endif
+ParticleBatch batch; // meshes and buffers for batched drawing
+FloorMesh floorMesh; // floors as one static buffer
+RenderState renderState; // the GL state last set, so only changes are sent
+double frameTimeTotal = 0; // render time of the offscreen frames
+int frameCount = 0;
+bool showProfile = false; // draw the profiler overlay?
+Profiler::Stats profileShown, profileTotals; // the last second, and the totals it was taken from
+chrono::steady_clock::time_point profileTaken;
 
 // cannon properties
-double spreadRandomness = 0.2; // randomness of stream
 bool constantFire = false; // constant fire?
-bool randSpeed = false; // random velocity of particle?
-
-list<Particle> listParticles;
-list<Floor> listFloors;
 
 /**
  * Glut Display Init function
  */
 void initGlut(void) {
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA | GLUT_DEPTH);
-	glutInitWindowSize(height, width);
+	glutInitWindowSize(width, height);
 	glutCreateWindow("Particle Simulation");
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-	glViewport(0, 0, height, width);
+	glViewport(0, 0, width, height);
+	renderState.init();
 }
 
 /**
- * Display Initialization function
- * sets up display for the program
+ * Window Reshape function
+ * the camera picks the new aspect up on the next frame
  */
-void initDisplay(void) {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // clear buffers
-	glClearDepth(1.0f); // set depth clear
-	glEnable(GL_DEPTH_TEST); // enable depth test
-	if (!useLight) { // if lights off
-		glDisable(GL_LIGHTING); // turn 'em off
-	}
-	else { // otherwise they're on
-		glEnable(GL_LIGHTING); // keep/turn them on
-	}
-	glEnable(GL_LIGHT0); // single light source
-	glLightfv(GL_LIGHT0, GL_POSITION, lightSource); // init light source
-	glEnable(GL_COLOR_MATERIAL); // enable material color tracking
-	glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE); // set it
-	glEnable(GL_BLEND); // enable blending
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); // set it
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	if (!useCull) { // using backface culling or not
-		glDisable(GL_CULL_FACE);
-	}
-	else { // yes
-		glEnable(GL_CULL_FACE);
-	}
-	glCullFace(GL_BACK); // only cull back
-	glDepthFunc(GL_LEQUAL); // depth buffer compares =<
-	if (shadeMode) { // flat or smooth
-		glShadeModel(GL_SMOOTH);
-	}
-	else {
-		glShadeModel(GL_FLAT);
-	}
-	// nicest perspective correction
-	glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
-	GLint viewport[4];
-	glGetIntegerv(GL_VIEWPORT, viewport);
-	double aspect = (double)viewport[2] / (double)viewport[3];
-	gluPerspective(74, aspect, 2, 300); // taken online for square aspect (n*n)
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	glEnable(GL_NORMALIZE);
-	double xCam = zoom * cos(yRotate); // for y-rot
-	double zCam = zoom * sin(yRotate); // for y-rot
-	gluLookAt(xCam, xRotate, zCam, 0, -20, 0, 0, 1, 0);
+void reshape(int w, int h) {
+	width = w; height = (h > 0) ? h : 1;
+	glViewport(0, 0, width, height);
 }
 
 /**
- * Particle Creation function
- * creates a new Particle for the environment
+ * Display Initialization function
+ * clears the frame and brings the lighting, shading, culling and camera
+ * up to date, which only reaches the GL for settings that changed
  */
-void addParticle() {
-	Particle p = Particle(firePosition, spreadRandomness, scaleFactor, ++particleCount, randSpeed);
-	listParticles.push_back(p);
+void initDisplay(void) {
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // clear buffers
+	renderState.set(RenderState::DepthTest, true);
+	renderState.set(RenderState::Lighting, useLight);
+	renderState.set(RenderState::CullFace, useCull);
+	renderState.shadeModel(shadeMode); // flat or smooth
+	renderState.camera(width, height, zoom, yRotate, xRotate, lightSource);
 }
 
 /**
- * Floor Collision Detection function
+ * Profiler overlay function
+ * prints the phase times and per step counters of the
+ * last second in the corner of the window
  */
-float floorCollision(Particle &p) {
-	float y = p.getPos()[1], x = p.getPos()[0], z = p.getPos()[2];
-	for (list<Floor>::iterator f = listFloors.begin(); f != listFloors.end(); ++f) { // check each floor
-		if ((y < (f->getPos() + (5 * p.getSize()))) // if collision
-			&& (x > (-f->getSize() - (5 * p.getSize()))) // and within certain dist
-			&& (x < (f->getSize() + (5 * p.getSize())))
-			&& (z > (-f->getSize() - (5 * p.getSize()))) // in both x and z planes
-			&& (z < (f->getSize() + (5 * p.getSize())))) {
-			return f->getPos(); // return collision y-position
-		}
+void drawProfile() {
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	if (now - profileTaken >= chrono::seconds(1)) { // refresh once a second
+		Profiler::Stats s = Profiler::get().stats();
+		profileShown = s.since(profileTotals);
+		profileTotals = s;
+		profileTaken = now;
 	}
-	return 0; // else no collision
-}
-
-/**
- * Interparticle Collision function
- */
-void particleCollision(Particle &p) {
-	/**
-	 * p = source particle, what to check against
-	 * q = particles in record
-	 */
-	for (list<Particle>::iterator q = listParticles.begin(); q != listParticles.end(); ++q) {
-		if (p.getId() != q->getId()) { // if not source particle
-			if (q->getCol() == 2 && p.getCol() == 1) {
-				/**
-				 * euclidean distance, etc
-				 */
-				double x = pow(((double)q->getPos()[0] - (double)p.getPos()[0]), 2);
-				double y = pow(((double)q->getPos()[1] - (double)p.getPos()[1]), 2);
-				double z = pow(((double)q->getPos()[2] - (double)p.getPos()[2]), 2);
-				double d = sqrt(x + y + z);
-				/**
-				 * change direction if collision along x or z plane
-				 * change in speed if collision along y plane
-				 */
-				if (d <= ((p.getSize() * 5) + (q->getSize() * 5))) {
-					bool bounceX = (p.getPos()[0] > q->getPos()[0]);
-					bool bounceY = (p.getPos()[1] > q->getPos()[1]);
-					bool bounceZ = (p.getPos()[2] > q->getPos()[2]);
-					p.changeDirection(bounceX, bounceZ, bounceY);
-				}
-			}
-		}
+	renderState.overlay(width, height);
+	glColor4ub(255, 255, 255, 255);
+	char line[80];
+	int y = height - 20;
+	for (int p = 0; p < Profiler::phaseCount; p++, y -= 15) {
+		snprintf(line, sizeof(line), "%-8s %8.3f ms  %4lld/s", Profiler::phaseName(p),
+			profileShown.meanMs(p), (long long)profileShown.phaseCalls[p]);
+		glRasterPos2i(10, y);
+		glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char*)line);
+	}
+	for (int c = 0; c < Profiler::counterCount; c++, y -= 15) {
+		double perStep = (profileShown.steps > 0) ? (double)profileShown.counts[c] / profileShown.steps : 0;
+		snprintf(line, sizeof(line), "%-16s %10.1f /step", Profiler::counterName(c), perStep);
+		glRasterPos2i(10, y);
+		glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char*)line);
 	}
 }
 
 /**
- * Particle Movement Function
- * For each particle in the record, move it based on
- * environment variables like friction, gravity, etc
+ * Function to draw every live particle as its own glut shape
+ * the appearance is a template argument so the shape is picked once
+ * per frame rather than once per particle
+ * @param particles - the particle record
  */
-void moveParticles() {
-	for (list<Particle>::iterator p = listParticles.begin(); p != listParticles.end(); ++p) { // for each particle
-		if (p->getSpeed() != 0) { // if particle is alive
-			p->move(gravity); // move it with regards to gravity
-		}
-		/**
-			* The below function checks the position a potential
-			* floor collision occurs. If one doesn't occur, it will
-			* return zero, otherwise a position value is returned
-			*/
-		float collisionPosition = floorCollision(*p);
-		if (numFloors != 0) { // if floors exist
-			if (collisionPosition != 0) { // if hit a floor
-				// change color status to indicate >0 bounces
-				if (p->getCol() == 0) { p->changeColor(); }
-				p->bounce(collisionPosition, friction); // apply friction
-				if (p->checkDead(gravity)) { // if particle is dead/dying
-					// change color status to indicate dying
-					if (p->getCol() == 1) { p->changeColor(); }
-				}
-			}
-			// check if particle off "killplane"
-			p->checkOffPyramid(removeParticles, listFloors.back().getPos());
+template <int AppType>
+void drawEach(const ParticleStore &particles) {
+	for (size_t p = 0; p < particles.count(); p++) { // for each particle
+		if (particles.life[p] > 0) { // if particle is alive
+			double blend = ((double)particles.life[p] / 100) * 255;
+			glPushMatrix();
+			int c = particles.color[p];
+			float s = particles.size[p];
+			/**
+			 * unbounced particles are cyan, bounced are yellow
+			 * and stationary are magenta. Magenta particles slowly fade
+			 * away which is done using the alpha channel
+			 */
+			glColor4ub(cArr[c][0], cArr[c][1], cArr[c][2], blend);
+			// go to position of particle
+			glTranslatef(particles.x[p], particles.y[p], particles.z[p]);
+			if (AppType == 1) { glutSolidCube(s * 5); }
+			else if (AppType == 2) { glutWireCube(s * 5); }
+			else if (AppType == 3) { glutSolidSphere(s * 5, 10, 15); }
+			else { glutWireSphere(s * 5, 10, 15); }
+			glPopMatrix();
 		}
-		// perform interparticle collision if flag set
-		if (particleBumping) { particleCollision(*p); }
 	}
 }
 
-/**
- * Function to remove particles from record
- * Below two functions combined for readability
- */
-bool recordRemovalPredicate(Particle &p) { return (p.getLife() <= 0); }
-void removeRecord() {
-	// removes particles based on conditional above
-	listParticles.remove_if(recordRemovalPredicate);
-}
-
 /**
  * Function to Render Scene
+ * draws the newest step the physics loop has finished
  */
 void drawScene(void) {
+	chrono::steady_clock::time_point frameStart = chrono::steady_clock::now();
+	PROFILE_SCOPE(Frame);
+	physics.advance(); // catch the physics up, unless it runs on its own thread
+	Snapshot &frame = physics.frame();
 	initDisplay(); // initialize display variables
-	if (constantFire && !animationPause) { // if constant stream enabled
-		addParticle(); // add a particle to scene
-	}
-	int i = numFloors-1;
-	for (list<Floor>::iterator f = listFloors.begin(); f != listFloors.end(); ++f) { // for each floor
-		// render that floor
-		double blend = 255-((double)(i--) / (double)(listFloors.size())) * 255;
-		glColor4ub(186, 126, 207, blend); // purple of varying alpha
-		glPushMatrix();
-		glTranslatef(0, f->getPos(), 0);
-		glScalef(f->getSize(), 0.1, f->getSize());
-		glutSolidCube(2);
-		glPopMatrix();
+	ParticleStore &particles = frame.particles;
+	floorMesh.draw(frame.floors); // purple of varying alpha, rebuilt only when the floors change
+	if (batchRender) { // every particle in view from one buffer, by its size on screen
+		batch.setView(renderState.viewProjection(), renderState.eyePosition(), renderState.pixelScale());
+		batch.draw(particles, appType, cArr);
 	}
-	glTranslatef(0, 0, 0); // go back to origin
-	for (list<Particle>::iterator p = listParticles.begin(); p != listParticles.end(); ++p) { // for each particle
-		if (p->getLife() > 0) { // if particle is alive
-			glPushMatrix();
-			double blend = ((double)p->getLife() / 100) * 255;
-			/**
-			 * unbounced particles are cyan, bounced are yellow
-			 * and stationary are magenta. Magenta particles slowly fade
-			 * away which is done using the alpha channel
-			 */
-			glColor4ub(cArr[p->getCol()][0], cArr[p->getCol()][1], cArr[p->getCol()][2], blend);
-			// go to position of particle
-			glTranslatef(p->getPos()[0], p->getPos()[1], p->getPos()[2]);
-			switch (appType) { // for appearance
-				case 1: glutSolidCube(p->getSize() * 5); break;
-				case 2: glutWireCube(p->getSize() * 5); break;
-				case 3: glutSolidSphere(p->getSize() * 5, 10, 15); break;
-				case 4: glutWireSphere(p->getSize() * 5, 10, 15); break;
-			}
-			glPopMatrix();
-			if (particlePaths) { // if pathdrawing enabled
-				glColor4ub(255, 255, 255, blend); // white
-				glBegin(GL_LINES); // start drawing path
-				list<Line> path = p->getPath();
-				Line lp = path.front(); // need an initial point
-				for (list<Line>::iterator l = path.begin(); l != path.end(); ++l) {
-					glVertex3f(lp.getPos()[0], lp.getPos()[1], lp.getPos()[2]); // connect l1
-					glVertex3f(l->getPos()[0], l->getPos()[1], l->getPos()[2]); // to l2
-					lp = *l; // create new initial point
-				}
-				glEnd();
-			}
+	else {
+		switch (appType) { // for appearance
+			case 1: drawEach<1>(particles); break;
+			case 2: drawEach<2>(particles); break;
+			case 3: drawEach<3>(particles); break;
+			case 4: drawEach<4>(particles); break;
 		}
 	}
-	if (!animationPause) { // if not paused
-		moveParticles(); // do movement logic
+	if (particlePaths) { batch.drawTrails(particles); } // every path straight from the trail arena
+	if (showProfile) { drawProfile(); }
+	if (offscreen) { // the run reports its frame times, so it waits for each frame
+		glFinish();
+		frameTimeTotal += chrono::duration<double, milli>(chrono::steady_clock::now() - frameStart).count();
+		frameCount++;
+#ifdef USE_EGL
+		capture.capture(); // only queued, the frame is written ring - 1 frames later
+#endif
+	}
+	else {
+		glFlush();
+		glutSwapBuffers();
 	}
-	glFlush();
-	glutSwapBuffers();
-	removeRecord(); // search for dead particles to remove
 }
 
 /**
- * Function to generate pyramid floors for environment
- * this creates five floors for the pyramid with params
- * -15,25, -12.5,20, -10,15, -7.5,10, -5,5 by default
+ * Function to print how the last frame's particles were drawn
  */
-void addFloor(int k) {
-	for (double i = -5.0, j = 5.0; k != 0; i -= 2.5, j += 5, k--) {
-		listFloors.push_back(Floor(i, j));
-	}
+void printDrawn() {
+	cout << "Particles Drawn: " << batch.getDrawn(ParticleCull::Full) << " full, "
+		<< batch.getDrawn(ParticleCull::Low) << " coarse, " << batch.getDrawn(ParticleCull::Point) << " points, "
+		<< batch.getDrawn(ParticleCull::Culled) << " culled" << (batch.isCulling() ? "" : " (culling off)") << endl;
 }
 
 /**
  * Function to print environment variables
  */
 void printVariables() {
-	cout << "Number of Particles: " << listParticles.size() << endl;
-	cout << "Current Gravity: " << gravity << endl;
-	cout << "Current Friction: " << friction << endl;
+	lock_guard<mutex> guard(physics.lock);
+	cout << "Number of Particles: " << sim.particles.alive() << endl;
+	cout << "Current Gravity: " << sim.gravity << endl;
+	cout << "Current Friction: " << sim.friction << endl;
+	cout << "Renderer: " << (batchRender ? "batched" : "per particle") << endl;
+	if (batchRender) { printDrawn(); }
+	cout << "Physics: " << (physics.isThreaded() ? "own thread" : "render thread")
+		<< ", " << physics.frame().steps << " steps" << endl;
+	fflush(stdout);
+	Profiler::print(stdout, Profiler::get().stats());
 }
 
 /**
@@ -300,16 +231,11 @@ void printVariables() {
  * Looks ugly but it takes a lot of space otherwise
  */
 void reset() {
-	scaleFactor = 0.25; gravity = 0.1; friction = 0.2;
-	appType = 3; spreadRandomness = 0.2; removeParticles = true;
-	constantFire = false; randSpeed = false; shadeMode = true; 
-	useLight = true; useCull = false; animationPause = false;
-	particleBumping = false; particlePaths = false;
-	yRotate = 212.50; xRotate = 25;	zoom = 50;
-	listParticles.clear(); listFloors.clear(); refreshRate = 20;
-	double xCam = zoom * cos(yRotate), zCam = zoom * sin(yRotate);
-	gluLookAt(xCam, xRotate, zCam, 0, -20, 0, 0, 1, 0);
-	firePosition[0] = 0; firePosition[2] = 0; numFloors = 5; addFloor(5);
+	lock_guard<mutex> guard(physics.lock);
+	appType = 3; constantFire = false; shadeMode = true; 
+	useLight = true; useCull = false; physics.paused = false; physics.timeScale = 1;
+	particlePaths = false; sim.reset(); sim.particles.setTrailCapacity(0);
+	yRotate = 212.50; xRotate = 25;	zoom = 50; // the next frame sets the camera
 }
 
 /**
@@ -324,12 +250,13 @@ void repeater(int val) {
  * Particle Gravity menu
  */
 void particleGravityMenu(int choice) {
+	lock_guard<mutex> guard(physics.lock);
 	switch (choice) {
-		case 1: { gravity = 0.000; break; } // zero gravity
-		case 2: { gravity = 0.025; break; } // 1/4 gravity
-		case 3: { gravity = 0.100; break; } // 1/1 gravity
-		case 4: { gravity = 0.400; break; } // 4/1 gravity
-		case 5: { gravity = 1.600; break; } // 16/1 gravity
+		case 1: { sim.gravity = 0.000; break; } // zero gravity
+		case 2: { sim.gravity = 0.025; break; } // 1/4 gravity
+		case 3: { sim.gravity = 0.100; break; } // 1/1 gravity
+		case 4: { sim.gravity = 0.400; break; } // 4/1 gravity
+		case 5: { sim.gravity = 1.600; break; } // 16/1 gravity
 	}
 }
 
@@ -337,12 +264,13 @@ void particleGravityMenu(int choice) {
  * Particle Friction menu
  */
 void particleFrictionMenu(int choice) {
+	lock_guard<mutex> guard(physics.lock);
 	switch (choice) {
-		case 1: { friction = 0.00; break; } // zero friction
-		case 2: { friction = 0.05; break; } // 1/4 friction
-		case 3: { friction = 0.20; break; } // 1/1 friction
-		case 4: { friction = 0.80; break; } // 4/1 friction
-		case 5: { friction = 3.20; break; } // 16/1 friction
+		case 1: { sim.friction = 0.00; break; } // zero friction
+		case 2: { sim.friction = 0.05; break; } // 1/4 friction
+		case 3: { sim.friction = 0.20; break; } // 1/1 friction
+		case 4: { sim.friction = 0.80; break; } // 4/1 friction
+		case 5: { sim.friction = 3.20; break; } // 16/1 friction
 	}
 }
 
@@ -362,12 +290,13 @@ void particleAppearanceMenu(int choice) {
  * Particle Size Menu
  */
 void particleSizeMenu(int choice) {
+	lock_guard<mutex> guard(physics.lock);
 	switch (choice) {
-		case 1: { scaleFactor = 0.025f; break; } // point
-		case 2: { scaleFactor = 0.050f; break; } // 1/4 size
-		case 3: { scaleFactor = 0.100f; break; } // 1/2 size
-		case 4: { scaleFactor = 0.200f; break; } // 1/1 size
-		case 5: { scaleFactor = 0.400f; break; } // 2/1 size
+		case 1: { sim.scaleFactor = 0.025f; break; } // point
+		case 2: { sim.scaleFactor = 0.050f; break; } // 1/4 size
+		case 3: { sim.scaleFactor = 0.100f; break; } // 1/2 size
+		case 4: { sim.scaleFactor = 0.200f; break; } // 1/1 size
+		case 5: { sim.scaleFactor = 0.400f; break; } // 2/1 size
 	}
 }
 
@@ -375,12 +304,13 @@ void particleSizeMenu(int choice) {
  * Particle Randomness Menu
  */
 void particleRandomnessMenu(int choice) {
+	lock_guard<mutex> guard(physics.lock);
 	switch (choice) {
-		case 1: { spreadRandomness = 0.00; break; } // not random
-		case 2: { spreadRandomness = 0.10; break; } // low randomness
-		case 3: { spreadRandomness = 0.20; break; } // normal randomness
-		case 4: { spreadRandomness = 0.30; break; } // very random
-		case 5: { spreadRandomness = 0.40; break; } // extremely random
+		case 1: { sim.spreadRandomness = 0.00; break; } // not random
+		case 2: { sim.spreadRandomness = 0.10; break; } // low randomness
+		case 3: { sim.spreadRandomness = 0.20; break; } // normal randomness
+		case 4: { sim.spreadRandomness = 0.30; break; } // very random
+		case 5: { sim.spreadRandomness = 0.40; break; } // extremely random
 	}
 }
 
@@ -388,9 +318,10 @@ void particleRandomnessMenu(int choice) {
  * Firing Options menu
  */
 void particleFiringMenu(int choice) {
+	lock_guard<mutex> guard(physics.lock);
 	switch (choice) {
 		case 1: { constantFire = !constantFire;	break; } // constant firing on/off
-		case 2: { randSpeed = !randSpeed; break; } // random particle velocity on/off
+		case 2: { sim.randSpeed = !sim.randSpeed; break; } // random particle velocity on/off
 	}
 }
 
@@ -409,11 +340,12 @@ void lightShadeMenu(int choice) {
  * Animation Speed options
  */
 void animationSpeedMenu(int choice) {
+	lock_guard<mutex> guard(physics.lock);
 	switch (choice) {
-		case 1: { refreshRate = 100; break;	} // slow
-		case 2: { refreshRate = 20;	break; } // default
-		case 3: { refreshRate = 5; break; } // fast
-		case 4: { animationPause = !animationPause; break; } // paused
+		case 1: { physics.timeScale = 0.2; break; } // slow
+		case 2: { physics.timeScale = 1; break; } // default
+		case 3: { physics.timeScale = 4; break; } // fast
+		case 4: { physics.paused = !physics.paused; break; } // paused
 	}
 }
 
@@ -423,10 +355,23 @@ void animationSpeedMenu(int choice) {
 void topMenu(int choice) {
 	switch (choice) {
 		case 'r': {	reset(); break; } // reset
-		case 'p': { animationPause = !animationPause; break; } // pause animation
+		case 'p': { // pause animation
+			lock_guard<mutex> guard(physics.lock);
+			physics.paused = !physics.paused;
+			break;
+		}
 		case 'q': { exit(0); break; } // quit program
-		case 1: { removeParticles = !removeParticles; break; } // toggle immortality
-		case 2: { particlePaths = !particlePaths; break; } // particle pathdrawing
+		case 1: { // toggle immortality
+			lock_guard<mutex> guard(physics.lock);
+			sim.removeParticles = !sim.removeParticles;
+			break;
+		}
+		case 2: { // particle pathdrawing, paths are only recorded while drawn
+			lock_guard<mutex> guard(physics.lock);
+			particlePaths = !particlePaths;
+			sim.particles.setTrailCapacity(particlePaths ? trailLength : 0);
+			break;
+		}
 	}
 }
 
@@ -434,8 +379,9 @@ void topMenu(int choice) {
  * Top level entry in particles menu
  */
 void particleMenu(int choice) {
+	lock_guard<mutex> guard(physics.lock);
 	switch (choice) {
-		case 1: { particleBumping = !particleBumping; break; } // interpart. coll.
+		case 1: { sim.particleBumping = !sim.particleBumping; break; } // interpart. coll.
 	}
 }
 
@@ -445,27 +391,35 @@ void particleMenu(int choice) {
  * performed with the keyboard.
  */
 void menu(unsigned char key, int x, int y) {
+	// these two take the lock themselves, stopping the physics thread waits on it
+	if (key == 'g') { printVariables(); return; } // show diagnostic
+	if (key == 't') { physics.setThreaded(!physics.isThreaded()); return; } // physics on its own thread
+	lock_guard<mutex> guard(physics.lock);
 	switch (key) {
-		case 'f': { addParticle(); break; } // manual fire
-		case 'g': { printVariables(); break; } // show diagnostic
+		case 'f': { sim.addParticle(); break; } // manual fire
+		case 'b': { batchRender = !batchRender; break; } // switch renderer
+		case 'c': { batch.setCulling(!batch.isCulling()); break; } // switch culling and level of detail
 		case '1': { yRotate = (yRotate == 359.9) ? 0.0 : yRotate + 0.1; break; } // y-rotate R
 		case '2': {	yRotate = (yRotate == 0.0) ? 359.9 : yRotate - 0.1;	break; } // y-rotate L
 		case '3': { xRotate += 1; break; } // x-rotate U
 		case '4': { xRotate -= 1; break; } // x-rotate D
 		case '5': { zoom++; break; } // zoom in
 		case '6': {	zoom--;	break; } // zoom out
-		case '7': { firePosition[0]++; break; } // move cannon x++
-		case '8': { firePosition[0]--; break; } // move cannon x--
-		case '9': { firePosition[2]++; break; } // move cannon z++
-		case '0': { firePosition[2]--; break; } // move cannon z--
-		case 'q': {
-			listFloors.clear();
-			addFloor(numFloors = (numFloors > 0) ? numFloors - 1 : 0);
+		case '7': { sim.firePosition[0]++; break; } // move cannon x++
+		case '8': { sim.firePosition[0]--; break; } // move cannon x--
+		case '9': { sim.firePosition[2]++; break; } // move cannon z++
+		case '0': { sim.firePosition[2]--; break; } // move cannon z--
+		case 'q': { sim.setFloors(sim.numFloors - 1); break; } // one less floor
+		case 'w': { sim.setFloors(sim.numFloors + 1); break; } // one more floor
+		case 'o': { showProfile = !showProfile; break; } // profiler overlay
+		case 's': { // save scene
+			cout << (SceneFile::save(sim, scenePath) ? "Saved " : "Could not save ") << scenePath << endl;
 			break;
 		}
-		case 'w': {
-			listFloors.clear();
-			addFloor(numFloors = (numFloors < 10) ? numFloors + 1 : 10);
+		case 'l': { // load scene, paths are drawn if it recorded them
+			bool loaded = SceneFile::load(sim, scenePath);
+			if (loaded) { particlePaths = (sim.particles.trailCapacity > 0); }
+			cout << (loaded ? "Loaded " : "Could not load ") << scenePath << endl;
 			break;
 		}
 	}
@@ -527,9 +481,9 @@ void initMenu() {
 	glutAddMenuEntry("Turn Culling On/Off", 3);
 	// menu for animation speed
 	int spdMenu = glutCreateMenu(animationSpeedMenu);
-	glutAddMenuEntry("Slow (1/15x)", 1);
+	glutAddMenuEntry("Slow (1/5x)", 1);
 	glutAddMenuEntry("Normal (1x)", 2);
-	glutAddMenuEntry("Fast (15x)", 3);
+	glutAddMenuEntry("Fast (4x)", 3);
 	// main menu to change settings
 	int mainMenu = glutCreateMenu(topMenu);
 	glutAddSubMenu("Gravity Settings", gravityMenu);
@@ -559,23 +513,134 @@ void printMenu() {
 	cout << "Press 'Q' to redesign environment with one less floor." << endl;
 	cout << "Press 'W' to redesign environment with one more floor." << endl;
 	cout << "Press 'G' to see diagnostic information on environment." << endl;
+	cout << "Press 'S' to save the scene to scene.psim and 'L' to load it back." << endl;
+	cout << "Press 'B' to switch between batched and per particle drawing." << endl;
+	cout << "Press 'T' to run the physics on its own thread or on the render thread." << endl;
+	cout << "Press 'C' to switch culling and level of detail of batched particles on or off." << endl;
+	cout << "Press 'O' to show the profiler overlay, 'G' also prints its totals." << endl;
+}
+
+/**
+ * Function which prints the command line options
+ */
+void printUsage(const char *name) {
+	cout << "usage: " << name << " [options]" << endl;
+	cout << "  --seed N        random seed (default the time)" << endl;
+	cout << "  --fire          start with constant fire on" << endl;
+	cout << "  --load FILE     start from a saved scene" << endl;
+	cout << "  --size WxH      window or frame size in pixels (default 800x800)" << endl;
+	cout << "  --no-cull       draw every particle with the full mesh" << endl;
+	cout << "  --offscreen     draw without a window or display, needs -DUSE_EGL -lEGL" << endl;
+	cout << "  --frames N      frames to draw offscreen before quitting (default 250)" << endl;
+	cout << "  --capture DEST  capture offscreen frames: a pattern with one %d like frames/%05d.ppm," << endl;
+	cout << "                  '|command' to pipe raw rgb24 frames, or a raw rgb24 file" << endl;
+}
+
+#ifdef USE_EGL
+/**
+ * Offscreen Driver
+ * draws frames into an offscreen context at the window's refresh rate,
+ * or as fast as they can be drawn if that is slower, while the physics
+ * runs on its own thread so it never waits on a frame or a capture
+ * @param frames - frames to draw before quitting
+ * @param capturePath - where captured frames go, 0 for none
+ */
+int runOffscreen(int frames, const char *capturePath) {
+	OffscreenContext context;
+	if (!context.create(width, height)) {
+		cout << "could not draw offscreen: " << context.getError() << endl;
+		return 1;
+	}
+	cout << "Renderer: " << context.renderer() << " at " << width << "x" << height << endl;
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	renderState.init();
+	if (capturePath && !capture.open(capturePath, width, height)) {
+		cout << "could not open capture " << capturePath << endl;
+		return 1;
+	}
+	physics.setThreaded(true);
+	chrono::steady_clock::time_point next = chrono::steady_clock::now();
+	for (int f = 0; f < frames; f++) {
+		drawScene();
+		next = max(next + chrono::milliseconds(refreshRate), chrono::steady_clock::now());
+		this_thread::sleep_until(next);
+	}
+	physics.setThreaded(false);
+	bool written = capture.close(); // the frames still in flight
+	cout << "Frames: " << frameCount << endl;
+	cout << "Steps: " << physics.frame().steps << endl;
+	cout << "Particles: " << sim.particles.alive() << endl;
+	if (frameCount > 0) { cout << "Average Frame Time: " << frameTimeTotal / frameCount << " ms" << endl; }
+	printDrawn();
+	if (capturePath) { cout << "Capture Stalls: " << capture.getStalls() << endl; }
+	if (!written) {
+		cout << "could not write frames to " << capturePath << endl;
+		return 1;
+	}
+	return 0;
 }
+#endif
 
 /**
  * Main Driver
  */
 int main(int argc, char** argv) {
-	listParticles = list<Particle>();
-	listFloors = list<Floor>();
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--offscreen") == 0) { offscreen = true; }
+	}
+	if (!offscreen) { glutInit(&argc, argv); } // takes the GLUT options out of argv
+	uint64_t seed = time(NULL);
+	const char *loadPath = 0, *capturePath = 0;
+	int frames = 250;
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if (strcmp(arg, "--seed") == 0 && hasValue) { seed = strtoull(argv[++i], 0, 10); }
+		else if (strcmp(arg, "--fire") == 0) { constantFire = true; }
+		else if (strcmp(arg, "--load") == 0 && hasValue) { loadPath = argv[++i]; }
+		else if (strcmp(arg, "--size") == 0 && hasValue && sscanf(argv[++i], "%dx%d", &width, &height) == 2
+			&& width > 0 && height > 0) {}
+		else if (strcmp(arg, "--offscreen") == 0) {}
+		else if (strcmp(arg, "--no-cull") == 0) { batch.setCulling(false); }
+		else if (strcmp(arg, "--frames") == 0 && hasValue) { frames = atoi(argv[++i]); }
+		else if (strcmp(arg, "--capture") == 0 && hasValue) { capturePath = argv[++i]; }
+		else {
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	if (capturePath && !offscreen) {
+		cout << "--capture needs --offscreen" << endl;
+		return 1;
+	}
+	sim.seed(seed);
+	cout << "Seed: " << seed << " (run with --seed " << seed << " to fire the same particles)" << endl;
+	sim.setThreads(thread::hardware_concurrency()); // one thread per core for physics
+	physics.onStep = []() { if (constantFire) { sim.addParticle(); } }; // constant stream, once per step
+	if (loadPath) {
+		lock_guard<mutex> guard(physics.lock);
+		if (!SceneFile::load(sim, loadPath)) {
+			cout << "could not load scene " << loadPath << endl;
+			return 1;
+		}
+		particlePaths = (sim.particles.trailCapacity > 0);
+	}
+	if (offscreen) {
+#ifdef USE_EGL
+		return runOffscreen(frames, capturePath);
+#else
+		(void)frames;
+		cout << "--offscreen needs building with -DUSE_EGL -lEGL" << endl;
+		return 1;
+#endif
+	}
 	printMenu();
-	srand((unsigned int)time(NULL));
-	glutInit(&argc, argv);
-	addFloor(5);
 	initGlut();
 	glutDisplayFunc(drawScene);
+	glutReshapeFunc(reshape);
 	glutKeyboardFunc(menu);
 	glutTimerFunc(0, repeater, 0);
 	initMenu();
 	glutMainLoop();
 	return 0; 
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -0,0 +1,116 @@
+#pragma once
+#include <math.h>
+#include <vector>
+
+/**
+ * SpatialGrid Class
+ * uniform spatial hash used as the broad phase of interparticle collision.
+ * space is cut into cubes one collision diameter wide and each
+ * collidable particle is bucketed by the cube it sits in, so a query only
+ * has to look at the 27 cubes around a position instead of the whole record.
+ * a particle can be bucketed twice in one step, where it was before it
+ * moved and where it is now, each entry seen only by the particles that
+ * met it in that state
+ */
+
+class SpatialGrid {
+public:
+	// which particles see an entry, by id against the entry's
+	enum Seen { ByAll, ByHigherIds, ByLowerIds };
+	// a particle as collision sees it
+	struct Entry {
+		float x, y, z, size;
+		int slot, id;
+		int seen;
+	};
+private:
+	float cellSize; // edge length of a cell
+	size_t mask; // table size - 1, table size is a power of two
+	std::vector<int> cellStart; // first entry of each bucket, prefix sums
+	std::vector<Entry> entries; // grouped by bucket
+	std::vector<size_t> keys; // bucket of each item
+	std::vector<int> fill; // next free entry of each bucket while building
+
+	// integer cell coordinate along one axis
+	int cell(float v) const {
+		return (int)floor((double)v / cellSize);
+	}
+	// bucket a cell falls in
+	size_t hash(int cx, int cy, int cz) const {
+		return (((size_t)cx * 73856093u) ^ ((size_t)cy * 19349663u) ^ ((size_t)cz * 83492791u)) & mask;
+	}
+public:
+	SpatialGrid() {
+		cellSize = 1;
+		mask = 0;
+	}
+	float getCellSize() const {
+		return cellSize;
+	}
+	// bucket of the cell a position falls in, queries from the same one visit the same buckets
+	size_t bucket(float x, float y, float z) const {
+		return hash(cell(x), cell(y), cell(z));
+	}
+	// makes room for n entries so building never allocates below that
+	void reserve(size_t n) {
+		size_t tableSize = 64;
+		while (tableSize < 2 * n) { tableSize <<= 1; }
+		cellStart.reserve(tableSize + 1); fill.reserve(tableSize + 1);
+		keys.reserve(n); entries.reserve(n);
+	}
+	/**
+	 * Grid rebuild function
+	 * buckets every item, the only particles that can be hit. items are
+	 * counting-sorted so each bucket lists them in the order given
+	 * @param items - the particles to bucket
+	 * @param cs - cell size, at least the largest collision distance
+	 */
+	void build(const std::vector<Entry> &items, float cs) {
+		cellSize = cs;
+		size_t n = items.size(), tableSize = 64;
+		while (tableSize < 2 * n) { tableSize <<= 1; }
+		mask = tableSize - 1;
+		cellStart.assign(tableSize + 1, 0);
+		keys.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			keys[i] = hash(cell(items[i].x), cell(items[i].y), cell(items[i].z));
+			cellStart[keys[i] + 1]++;
+		}
+		for (size_t h = 0; h < tableSize; h++) { // running total gives bucket starts
+			cellStart[h + 1] += cellStart[h];
+		}
+		entries.resize(n);
+		fill.assign(cellStart.begin(), cellStart.end() - 1);
+		for (size_t i = 0; i < n; i++) { entries[fill[keys[i]]++] = items[i]; }
+	}
+	// an entry passed to a query's visitor
+	const Entry &entry(int e) const {
+		return entries[e];
+	}
+	/**
+	 * Neighbour query function
+	 * calls f(e, entry) for every entry in the 27 cells around a position.
+	 * buckets shared by two of those cells are only visited once,
+	 * particles from other cells hashed into the same bucket are included
+	 * @param x, y, z - position to query around
+	 * @param f - visitor taking an entry's number and the entry
+	 */
+	template <class F>
+	void query(float x, float y, float z, F &f) const {
+		int cx = cell(x), cy = cell(y), cz = cell(z);
+		size_t seen[27];
+		int numSeen = 0;
+		for (int i = -1; i <= 1; i++) {
+			for (int j = -1; j <= 1; j++) {
+				for (int k = -1; k <= 1; k++) {
+					size_t h = hash(cx + i, cy + j, cz + k);
+					bool dup = false;
+					for (int s = 0; s < numSeen && !dup; s++) { dup = (seen[s] == h); }
+					if (dup) { continue; }
+					seen[numSeen++] = h;
+					for (int e = cellStart[h]; e < cellStart[h + 1]; e++) { f(e, entries[e]); }
+				}
+			}
+		}
+	}
+};
@@ -0,0 +1,343 @@
+#pragma once
+#include <math.h>
+#include <stddef.h>
+#include "ParticleStore.h"
+#include "FloorIndex.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define STEP_KERNEL_X86 1
+#endif
+
+/**
+ * StepKernel Class
+ * the movement and floor collision part of the physics step, run over a
+ * range of the particle record. besides the plain loop there are AVX2
+ * and AVX-512 versions that handle 8 or 16 particles per instruction.
+ * the widest one the cpu supports is picked at runtime. all versions do
+ * the same float and double operations in the same order as the
+ * ParticleStore methods, so they give bit-identical results
+ */
+
+class StepKernel {
+public:
+	enum Isa { Scalar = 0, Avx2 = 1, Avx512 = 2 };
+private:
+	Isa isa; // instruction set in use
+public:
+	StepKernel() {
+		isa = detect();
+	}
+	// widest instruction set this cpu and compiler support
+	static Isa detect() {
+#ifdef STEP_KERNEL_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f")) { return Avx512; }
+		if (__builtin_cpu_supports("avx2")) { return Avx2; }
+#endif
+		return Scalar;
+	}
+	static const char *name(Isa i) {
+		switch (i) {
+			case Avx2: return "avx2";
+			case Avx512: return "avx512";
+			default: return "scalar";
+		}
+	}
+	Isa getIsa() const {
+		return isa;
+	}
+	// picks an instruction set, capped to what the cpu supports
+	void setIsa(Isa i) {
+		isa = (i > detect()) ? detect() : i;
+	}
+	/**
+	 * Integration function
+	 * applies gravity and velocity to every moving particle, as in
+	 * ParticleStore::move minus the path drawing
+	 * @param g - gravity
+	 * @param moved - set to 1 for particles that moved, 0 otherwise
+	 */
+	void integrate(ParticleStore &ps, size_t begin, size_t end, double g, unsigned char *moved) const {
+		size_t i = begin;
+#ifdef STEP_KERNEL_X86
+		if (isa == Avx512) { i = integrateAvx512(ps, begin, end, g, moved); }
+		else if (isa == Avx2) { i = integrateAvx2(ps, begin, end, g, moved); }
+#endif
+		for (; i < end; i++) { // scalar loop, also finishes the vector tail
+			moved[i] = (ps.speed[i] != 0);
+			if (moved[i]) {
+				ps.speed[i] -= g;
+				ps.x[i] += ps.dx[i];
+				ps.y[i] += ps.dy[i] + ps.speed[i];
+				ps.z[i] += ps.dz[i];
+			}
+		}
+	}
+	/**
+	 * Floor collision function
+	 * finds the first floor each particle hits, in floor order, and
+	 * bounces it off that floor as in ParticleStore::bounce.
+	 * the scalar loop looks the floor up in the index, the vector loops
+	 * count the floors each particle is not over when the stack widens
+	 * going down, and test every floor otherwise
+	 * @param fi - the floors, compiled
+	 * @param f - friction
+	 * @param hit - position of the floor hit, 0 if none
+	 */
+	void floors(ParticleStore &ps, size_t begin, size_t end, const FloorIndex &fi, double f, float *hit) const {
+		size_t i = begin;
+#ifdef STEP_KERNEL_X86
+		const float *fp = fi.positions(), *fs = fi.sizes();
+		int nf = fi.count();
+		bool nested = (fi.getLayout() == FloorIndex::Pyramid || fi.getLayout() == FloorIndex::Nested);
+		if (isa == Avx512) {
+			i = nested ? nestedFloorsAvx512(ps, begin, end, fp, fs, nf, f, hit) : floorsAvx512(ps, begin, end, fp, fs, nf, f, hit);
+		}
+		else if (isa == Avx2) {
+			i = nested ? nestedFloorsAvx2(ps, begin, end, fp, fs, nf, f, hit) : floorsAvx2(ps, begin, end, fp, fs, nf, f, hit);
+		}
+#endif
+		for (; i < end; i++) {
+			int k = fi.firstHit(ps.x[i], ps.y[i], ps.z[i], 5 * ps.size[i]);
+			hit[i] = (k >= 0) ? fi.positions()[k] : 0;
+			if (hit[i] != 0) { ps.bounce(i, hit[i], f); }
+		}
+	}
+private:
+#ifdef STEP_KERNEL_X86
+// gcc 12 warns about the deliberately undefined upper lanes inside its own intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+	/**
+	 * round() for 4 doubles, halfway cases away from zero.
+	 * truncates, then steps one away from zero if the dropped part
+	 * was at least a half, which is exact for any double
+	 */
+	__attribute__((target("avx2")))
+	static __m256d roundAvx2(__m256d v) {
+		__m256d t = _mm256_round_pd(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+		__m256d signMask = _mm256_set1_pd(-0.0);
+		__m256d frac = _mm256_andnot_pd(signMask, _mm256_sub_pd(v, t));
+		__m256d away = _mm256_add_pd(t, _mm256_or_pd(_mm256_set1_pd(1.0), _mm256_and_pd(signMask, v)));
+		return _mm256_blendv_pd(t, away, _mm256_cmp_pd(frac, _mm256_set1_pd(0.5), _CMP_GE_OQ));
+	}
+	// bounce speed of 4 particles, same steps as ParticleStore::bounce
+	__attribute__((target("avx2")))
+	static __m128 bounceSpeedAvx2(__m128 s, __m256d onePlusF) {
+		__m256d d = _mm256_div_pd(_mm256_cvtps_pd(_mm_xor_ps(s, _mm_set1_ps(-0.0f))), onePlusF);
+		d = roundAvx2(_mm256_mul_pd(_mm256_set1_pd(10000.0), d));
+		return _mm256_cvtpd_ps(_mm256_div_pd(d, _mm256_set1_pd(10000.0)));
+	}
+	__attribute__((target("avx2")))
+	static size_t integrateAvx2(ParticleStore &ps, size_t begin, size_t end, double g, unsigned char *moved) {
+		float *x = ps.x.data(), *y = ps.y.data(), *z = ps.z.data(), *sp = ps.speed.data();
+		const float *dx = ps.dx.data(), *dy = ps.dy.data(), *dz = ps.dz.data();
+		__m256d gv = _mm256_set1_pd(g);
+		size_t i = begin;
+		for (; i + 8 <= end; i += 8) {
+			__m256 s = _mm256_loadu_ps(sp + i);
+			__m256 m = _mm256_cmp_ps(s, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+			// speed -= g is done in double, as the scalar code promotes
+			__m128 lo = _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(s)), gv));
+			__m128 hi = _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(s, 1)), gv));
+			__m256 ns = _mm256_blendv_ps(s, _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1), m);
+			__m256 vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i), vz = _mm256_loadu_ps(z + i);
+			_mm256_storeu_ps(sp + i, ns);
+			_mm256_storeu_ps(x + i, _mm256_blendv_ps(vx, _mm256_add_ps(vx, _mm256_loadu_ps(dx + i)), m));
+			_mm256_storeu_ps(y + i, _mm256_blendv_ps(vy, _mm256_add_ps(vy, _mm256_add_ps(_mm256_loadu_ps(dy + i), ns)), m));
+			_mm256_storeu_ps(z + i, _mm256_blendv_ps(vz, _mm256_add_ps(vz, _mm256_loadu_ps(dz + i)), m));
+			int bits = _mm256_movemask_ps(m);
+			for (int b = 0; b < 8; b++) { moved[i + b] = (bits >> b) & 1; }
+		}
+		return i;
+	}
+	__attribute__((target("avx2")))
+	static size_t floorsAvx2(ParticleStore &ps, size_t begin, size_t end, const float *fp, const float *fs, int nf, double f, float *hit) {
+		float *y = ps.y.data(), *sp = ps.speed.data();
+		const float *x = ps.x.data(), *z = ps.z.data(), *sz = ps.size.data();
+		__m256d onePlusF = _mm256_set1_pd(1 + f);
+		size_t i = begin;
+		for (; i + 8 <= end; i += 8) {
+			__m256 vx = _mm256_loadu_ps(x + i), vy = _mm256_loadu_ps(y + i), vz = _mm256_loadu_ps(z + i);
+			__m256 r = _mm256_mul_ps(_mm256_set1_ps(5.0f), _mm256_loadu_ps(sz + i));
+			__m256 found = _mm256_setzero_ps(), pos = _mm256_setzero_ps();
+			for (int k = 0; k < nf; k++) {
+				__m256 p = _mm256_set1_ps(fp[k]), w = _mm256_set1_ps(fs[k]), nw = _mm256_set1_ps(-fs[k]);
+				__m256 c = _mm256_cmp_ps(vy, _mm256_add_ps(p, r), _CMP_LT_OQ);
+				c = _mm256_and_ps(c, _mm256_cmp_ps(vx, _mm256_sub_ps(nw, r), _CMP_GT_OQ));
+				c = _mm256_and_ps(c, _mm256_cmp_ps(vx, _mm256_add_ps(w, r), _CMP_LT_OQ));
+				c = _mm256_and_ps(c, _mm256_cmp_ps(vz, _mm256_sub_ps(nw, r), _CMP_GT_OQ));
+				c = _mm256_and_ps(c, _mm256_cmp_ps(vz, _mm256_add_ps(w, r), _CMP_LT_OQ));
+				c = _mm256_andnot_ps(found, c); // first floor hit wins
+				pos = _mm256_blendv_ps(pos, p, c);
+				found = _mm256_or_ps(found, c);
+			}
+			_mm256_storeu_ps(hit + i, pos);
+			if (_mm256_movemask_ps(found) == 0) { continue; }
+			// bounce: sit on the floor and reflect speed with friction
+			_mm256_storeu_ps(y + i, _mm256_blendv_ps(vy, _mm256_add_ps(pos, r), found));
+			__m256 s = _mm256_loadu_ps(sp + i);
+			__m128 lo = bounceSpeedAvx2(_mm256_castps256_ps128(s), onePlusF);
+			__m128 hi = bounceSpeedAvx2(_mm256_extractf128_ps(s, 1), onePlusF);
+			__m256 ns = _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+			_mm256_storeu_ps(sp + i, _mm256_blendv_ps(s, ns, found));
+		}
+		return i;
+	}
+	/**
+	 * floors for a stack that widens going down: the first floor a
+	 * particle is over is the count of floors it is not over, and is the
+	 * only one it can hit
+	 */
+	__attribute__((target("avx2")))
+	static size_t nestedFloorsAvx2(ParticleStore &ps, size_t begin, size_t end, const float *fp, const float *fs, int nf, double f, float *hit) {
+		float *y = ps.y.data(), *sp = ps.speed.data();
+		const float *x = ps.x.data(), *z = ps.z.data(), *sz = ps.size.data();
+		__m256d onePlusF = _mm256_set1_pd(1 + f);
+		__m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+		__m256i last = _mm256_set1_epi32(nf - 1);
+		size_t i = begin;
+		if (nf == 0) { return i; }
+		for (; i + 8 <= end; i += 8) {
+			__m256 vy = _mm256_loadu_ps(y + i);
+			__m256 m = _mm256_max_ps(_mm256_and_ps(_mm256_loadu_ps(x + i), absMask), _mm256_and_ps(_mm256_loadu_ps(z + i), absMask));
+			__m256 r = _mm256_mul_ps(_mm256_set1_ps(5.0f), _mm256_loadu_ps(sz + i));
+			__m256i k = _mm256_setzero_si256();
+			for (int j = 0; j < nf; j++) { // the not-over mask is -1, so subtracting counts
+				__m256 notOver = _mm256_cmp_ps(m, _mm256_add_ps(_mm256_set1_ps(fs[j]), r), _CMP_NLT_UQ);
+				k = _mm256_sub_epi32(k, _mm256_castps_si256(notOver));
+			}
+			__m256 p = _mm256_i32gather_ps(fp, _mm256_min_epi32(k, last), 4);
+			__m256 found = _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(nf), k)),
+				_mm256_cmp_ps(vy, _mm256_add_ps(p, r), _CMP_LT_OQ));
+			__m256 pos = _mm256_and_ps(p, found);
+			_mm256_storeu_ps(hit + i, pos);
+			if (_mm256_movemask_ps(found) == 0) { continue; }
+			// bounce: sit on the floor and reflect speed with friction
+			_mm256_storeu_ps(y + i, _mm256_blendv_ps(vy, _mm256_add_ps(pos, r), found));
+			__m256 s = _mm256_loadu_ps(sp + i);
+			__m128 lo = bounceSpeedAvx2(_mm256_castps256_ps128(s), onePlusF);
+			__m128 hi = bounceSpeedAvx2(_mm256_extractf128_ps(s, 1), onePlusF);
+			__m256 ns = _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+			_mm256_storeu_ps(sp + i, _mm256_blendv_ps(s, ns, found));
+		}
+		return i;
+	}
+	// round() for 8 doubles, see roundAvx2
+	__attribute__((target("avx512f")))
+	static __m512d roundAvx512(__m512d v) {
+		__m512d t = _mm512_roundscale_pd(v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+		__m512d frac = _mm512_abs_pd(_mm512_sub_pd(v, t));
+		__m512d one = _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(_mm512_set1_pd(1.0)),
+			_mm512_and_si512(_mm512_castpd_si512(v), _mm512_castpd_si512(_mm512_set1_pd(-0.0)))));
+		__mmask8 m = _mm512_cmp_pd_mask(frac, _mm512_set1_pd(0.5), _CMP_GE_OQ);
+		return _mm512_mask_add_pd(t, m, t, one);
+	}
+	// bounce speed of 8 particles, same steps as ParticleStore::bounce
+	__attribute__((target("avx512f")))
+	static __m256 bounceSpeedAvx512(__m256 s, __m512d onePlusF) {
+		__m512d d = _mm512_div_pd(_mm512_cvtps_pd(_mm256_xor_ps(s, _mm256_set1_ps(-0.0f))), onePlusF);
+		d = roundAvx512(_mm512_mul_pd(_mm512_set1_pd(10000.0), d));
+		return _mm512_cvtpd_ps(_mm512_div_pd(d, _mm512_set1_pd(10000.0)));
+	}
+	// joins two halves of 8 floats into 16
+	__attribute__((target("avx512f")))
+	static __m512 join(__m256 lo, __m256 hi) {
+		return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(lo)), _mm256_castps_pd(hi), 1));
+	}
+	// upper 8 of 16 floats
+	__attribute__((target("avx512f")))
+	static __m256 upper(__m512 v) {
+		return _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1));
+	}
+	__attribute__((target("avx512f")))
+	static size_t integrateAvx512(ParticleStore &ps, size_t begin, size_t end, double g, unsigned char *moved) {
+		float *x = ps.x.data(), *y = ps.y.data(), *z = ps.z.data(), *sp = ps.speed.data();
+		const float *dx = ps.dx.data(), *dy = ps.dy.data(), *dz = ps.dz.data();
+		__m512d gv = _mm512_set1_pd(g);
+		size_t i = begin;
+		for (; i + 16 <= end; i += 16) {
+			__m512 s = _mm512_loadu_ps(sp + i);
+			__mmask16 m = _mm512_cmp_ps_mask(s, _mm512_setzero_ps(), _CMP_NEQ_UQ);
+			// speed -= g is done in double, as the scalar code promotes
+			__m256 lo = _mm512_cvtpd_ps(_mm512_sub_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(s)), gv));
+			__m256 hi = _mm512_cvtpd_ps(_mm512_sub_pd(_mm512_cvtps_pd(upper(s)), gv));
+			__m512 ns = _mm512_mask_blend_ps(m, s, join(lo, hi));
+			__m512 vx = _mm512_loadu_ps(x + i), vy = _mm512_loadu_ps(y + i), vz = _mm512_loadu_ps(z + i);
+			_mm512_storeu_ps(sp + i, ns);
+			_mm512_storeu_ps(x + i, _mm512_mask_add_ps(vx, m, vx, _mm512_loadu_ps(dx + i)));
+			_mm512_storeu_ps(y + i, _mm512_mask_add_ps(vy, m, vy, _mm512_add_ps(_mm512_loadu_ps(dy + i), ns)));
+			_mm512_storeu_ps(z + i, _mm512_mask_add_ps(vz, m, vz, _mm512_loadu_ps(dz + i)));
+			for (int b = 0; b < 16; b++) { moved[i + b] = (m >> b) & 1; }
+		}
+		return i;
+	}
+	__attribute__((target("avx512f")))
+	static size_t floorsAvx512(ParticleStore &ps, size_t begin, size_t end, const float *fp, const float *fs, int nf, double f, float *hit) {
+		float *y = ps.y.data(), *sp = ps.speed.data();
+		const float *x = ps.x.data(), *z = ps.z.data(), *sz = ps.size.data();
+		__m512d onePlusF = _mm512_set1_pd(1 + f);
+		size_t i = begin;
+		for (; i + 16 <= end; i += 16) {
+			__m512 vx = _mm512_loadu_ps(x + i), vy = _mm512_loadu_ps(y + i), vz = _mm512_loadu_ps(z + i);
+			__m512 r = _mm512_mul_ps(_mm512_set1_ps(5.0f), _mm512_loadu_ps(sz + i));
+			__mmask16 found = 0;
+			__m512 pos = _mm512_setzero_ps();
+			for (int k = 0; k < nf; k++) {
+				__m512 p = _mm512_set1_ps(fp[k]), w = _mm512_set1_ps(fs[k]), nw = _mm512_set1_ps(-fs[k]);
+				__mmask16 c = _mm512_cmp_ps_mask(vy, _mm512_add_ps(p, r), _CMP_LT_OQ);
+				c &= _mm512_cmp_ps_mask(vx, _mm512_sub_ps(nw, r), _CMP_GT_OQ);
+				c &= _mm512_cmp_ps_mask(vx, _mm512_add_ps(w, r), _CMP_LT_OQ);
+				c &= _mm512_cmp_ps_mask(vz, _mm512_sub_ps(nw, r), _CMP_GT_OQ);
+				c &= _mm512_cmp_ps_mask(vz, _mm512_add_ps(w, r), _CMP_LT_OQ);
+				c &= ~found; // first floor hit wins
+				pos = _mm512_mask_blend_ps(c, pos, p);
+				found |= c;
+			}
+			_mm512_storeu_ps(hit + i, pos);
+			if (found == 0) { continue; }
+			// bounce: sit on the floor and reflect speed with friction
+			_mm512_storeu_ps(y + i, _mm512_mask_add_ps(vy, found, pos, r));
+			__m512 s = _mm512_loadu_ps(sp + i);
+			__m256 lo = bounceSpeedAvx512(_mm512_castps512_ps256(s), onePlusF);
+			__m256 hi = bounceSpeedAvx512(upper(s), onePlusF);
+			_mm512_storeu_ps(sp + i, _mm512_mask_blend_ps(found, s, join(lo, hi)));
+		}
+		return i;
+	}
+	// see nestedFloorsAvx2
+	__attribute__((target("avx512f")))
+	static size_t nestedFloorsAvx512(ParticleStore &ps, size_t begin, size_t end, const float *fp, const float *fs, int nf, double f, float *hit) {
+		float *y = ps.y.data(), *sp = ps.speed.data();
+		const float *x = ps.x.data(), *z = ps.z.data(), *sz = ps.size.data();
+		__m512d onePlusF = _mm512_set1_pd(1 + f);
+		__m512i last = _mm512_set1_epi32(nf - 1), one = _mm512_set1_epi32(1);
+		size_t i = begin;
+		if (nf == 0) { return i; }
+		for (; i + 16 <= end; i += 16) {
+			__m512 vy = _mm512_loadu_ps(y + i);
+			__m512 m = _mm512_max_ps(_mm512_abs_ps(_mm512_loadu_ps(x + i)), _mm512_abs_ps(_mm512_loadu_ps(z + i)));
+			__m512 r = _mm512_mul_ps(_mm512_set1_ps(5.0f), _mm512_loadu_ps(sz + i));
+			__m512i k = _mm512_setzero_si512();
+			for (int j = 0; j < nf; j++) {
+				__mmask16 notOver = _mm512_cmp_ps_mask(m, _mm512_add_ps(_mm512_set1_ps(fs[j]), r), _CMP_NLT_UQ);
+				k = _mm512_mask_add_epi32(k, notOver, k, one);
+			}
+			__m512 p = _mm512_i32gather_ps(_mm512_min_epi32(k, last), fp, 4);
+			__mmask16 found = _mm512_cmplt_epi32_mask(k, _mm512_set1_epi32(nf));
+			found &= _mm512_cmp_ps_mask(vy, _mm512_add_ps(p, r), _CMP_LT_OQ);
+			__m512 pos = _mm512_maskz_mov_ps(found, p);
+			_mm512_storeu_ps(hit + i, pos);
+			if (found == 0) { continue; }
+			// bounce: sit on the floor and reflect speed with friction
+			_mm512_storeu_ps(y + i, _mm512_mask_add_ps(vy, found, pos, r));
+			__m512 s = _mm512_loadu_ps(sp + i);
+			__m256 lo = bounceSpeedAvx512(_mm512_castps512_ps256(s), onePlusF);
+			__m256 hi = bounceSpeedAvx512(upper(s), onePlusF);
+			_mm512_storeu_ps(sp + i, _mm512_mask_blend_ps(found, s, join(lo, hi)));
+		}
+		return i;
+	}
+#pragma GCC diagnostic pop
+#endif
+};
\ No newline at end of file
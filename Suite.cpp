@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <malloc.h>
+#include <sys/resource.h>
+#include "Simulation.h"
+
+using namespace std;
+
+/**
+ * Benchmark Suite
+ * runs a fixed set of canonical scenes headlessly for a fixed number of
+ * steps and reports throughput, median and 99th percentile step time
+ * and peak resident memory of each as JSON. given a baseline written by
+ * an earlier run it fails when any scene got slower or bigger by more
+ * than the tolerance, so a regression shows up as an exit code. each
+ * scene is run a few times and the best of each metric is kept, which
+ * keeps the numbers steady enough to compare between runs
+ */
+
+// one canonical scene, built from the same knobs as the window's menus
+struct Scene {
+	const char *name;
+	int floors;
+	int sources; // emitters in a ring around the cannon, 1 for the cannon alone
+	int rate; // particles fired per step by each
+	double gravity;
+	bool bumping, immortal;
+	int trail; // path points per particle, 0 for none
+	long steps;
+};
+
+const Scene scenes[] = {
+	{ "fire5", 5, 1, 50, 0.1, false, false, 0, 2000 }, // constant fire on the default pyramid
+	{ "bump10", 10, 1, 10, 0.1, true, false, 0, 600 }, // interparticle collision on ten floors
+	{ "paths", 5, 1, 50, 0.1, false, false, 64, 2000 },
+	{ "gravity16", 5, 1, 200, 0.1 * 16, false, false, 0, 2000 }, // sixteen times the default gravity
+	{ "immortal", 5, 1, 50, 0.1, false, true, 0, 2000 }, // nothing is removed, the pile only grows
+	{ "emitters", 10, 8, 250, 0.1, false, false, 0, 300 }, // thousands of particles a step from eight sources
+};
+const int sceneCount = sizeof(scenes) / sizeof(scenes[0]);
+
+struct Result {
+	string name;
+	long steps;
+	size_t peakParticles;
+	double seconds, stepsPerSecond, p50Ms, p99Ms, peakRssMb;
+	uint64_t checksum;
+};
+
+/**
+ * Function which resets the peak resident set size of the process
+ * so every scene reports its own peak, needs Linux 4.0. the heap left
+ * over from the last scene is handed back first so it is not counted
+ */
+void resetPeakRss() {
+	malloc_trim(0);
+	FILE *f = fopen("/proc/self/clear_refs", "w");
+	if (f) {
+		fputs("5", f);
+		fclose(f);
+	}
+}
+
+/**
+ * Function which reads the peak resident set size in megabytes
+ * since the last reset, or since the process started if that failed
+ */
+double peakRssMb() {
+	FILE *f = fopen("/proc/self/status", "r");
+	char line[256];
+	while (f && fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "VmHWM:", 6) == 0) {
+			fclose(f);
+			return atol(line + 6) / 1024.0;
+		}
+	}
+	if (f) { fclose(f); }
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.0;
+}
+
+// value at fraction q of a sorted list
+double percentile(const vector<double> &sorted, double q) {
+	if (sorted.empty()) { return 0; }
+	return sorted[min((size_t)(q * sorted.size()), sorted.size() - 1)];
+}
+
+/**
+ * Scene running function
+ * fires and steps a fresh simulation, timing every step on its own
+ * @param threads - threads the step is split across
+ */
+Result runScene(const Scene &scene, int threads) {
+	resetPeakRss();
+	Result r;
+	vector<double> stepMs;
+	{
+		Simulation sim;
+		sim.seed(1);
+		sim.setThreads(threads);
+		sim.setFloors(scene.floors);
+		sim.gravity = scene.gravity;
+		sim.particleBumping = scene.bumping;
+		sim.removeParticles = !scene.immortal;
+		sim.particles.setTrailCapacity(scene.trail);
+		for (int e = 0; e < scene.sources; e++) {
+			float p[3] = { sim.firePosition[0], sim.firePosition[1], sim.firePosition[2] };
+			if (scene.sources > 1) { // spread around the top of the pyramid
+				p[0] += 4 * (float)cos(2 * M_PI * e / scene.sources);
+				p[2] += 4 * (float)sin(2 * M_PI * e / scene.sources);
+			}
+			sim.emitters.push_back(Emitter(p, scene.rate, sim.spreadRandomness, sim.randSpeed));
+		}
+		stepMs.reserve(scene.steps);
+		r.peakParticles = 0;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (long s = 0; s < scene.steps; s++) {
+			chrono::steady_clock::time_point t = chrono::steady_clock::now();
+			sim.emit(); // constant fire
+			sim.step();
+			stepMs.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - t).count());
+			r.peakParticles = max(r.peakParticles, sim.liveCount());
+		}
+		r.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		r.checksum = sim.particles.checksum();
+	}
+	r.peakRssMb = peakRssMb();
+	sort(stepMs.begin(), stepMs.end());
+	r.name = scene.name;
+	r.steps = scene.steps;
+	r.stepsPerSecond = (r.seconds > 0) ? r.steps / r.seconds : 0;
+	r.p50Ms = percentile(stepMs, 0.5);
+	r.p99Ms = percentile(stepMs, 0.99);
+	return r;
+}
+
+/**
+ * JSON output function
+ * one object per scene, the same layout the baseline is read back from
+ */
+void writeJson(FILE *f, const vector<Result> &results, int threads) {
+	fprintf(f, "{\n  \"threads\": %d,\n  \"scenes\": [\n", threads);
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		fprintf(f, "    {\"name\": \"%s\", \"steps\": %ld, \"peak_particles\": %zu, \"seconds\": %.4f, "
+			"\"steps_per_second\": %.2f, \"p50_ms\": %.4f, \"p99_ms\": %.4f, \"peak_rss_mb\": %.1f, "
+			"\"checksum\": \"%016llx\"}%s\n",
+			r.name.c_str(), r.steps, r.peakParticles, r.seconds, r.stepsPerSecond, r.p50Ms, r.p99Ms,
+			r.peakRssMb, (unsigned long long)r.checksum, (i + 1 < results.size()) ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+/**
+ * Baseline lookup function
+ * finds a field of one scene in JSON written by writeJson, this is not
+ * a general JSON parser
+ * @return false if the scene or field is not there
+ */
+bool baselineValue(const string &json, const string &scene, const char *key, double &value) {
+	size_t begin = json.find("\"name\": \"" + scene + "\"");
+	if (begin == string::npos) { return false; }
+	size_t end = json.find('}', begin);
+	size_t at = json.find(string("\"") + key + "\": ", begin);
+	if (at == string::npos || at > end) { return false; }
+	value = atof(json.c_str() + at + strlen(key) + 4);
+	return true;
+}
+
+/**
+ * Regression check function
+ * compares every result against the baseline, lower throughput or
+ * higher latency or memory than the tolerance allows is a regression
+ * @return number of regressions
+ */
+int compareBaseline(const string &json, const vector<Result> &results, double tolerance) {
+	int regressions = 0;
+	fprintf(stderr, "%-10s %-18s %12s %12s %9s\n", "scene", "metric", "baseline", "now", "change");
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		struct { const char *key; double now; bool higherIsBetter; } metrics[] = {
+			{ "steps_per_second", r.stepsPerSecond, true },
+			{ "p50_ms", r.p50Ms, false },
+			{ "p99_ms", r.p99Ms, false },
+			{ "peak_rss_mb", r.peakRssMb, false },
+		};
+		for (int m = 0; m < 4; m++) {
+			double base;
+			if (!baselineValue(json, r.name, metrics[m].key, base)) {
+				fprintf(stderr, "%-10s %-18s %12s\n", r.name.c_str(), metrics[m].key, "missing");
+				continue;
+			}
+			double change = (base > 0) ? (metrics[m].now - base) / base * 100 : 0;
+			bool worse = metrics[m].higherIsBetter ? (change < -tolerance) : (change > tolerance);
+			fprintf(stderr, "%-10s %-18s %12.4f %12.4f %+8.1f%%%s\n", r.name.c_str(), metrics[m].key,
+				base, metrics[m].now, change, worse ? "  REGRESSION" : "");
+			if (worse) { regressions++; }
+		}
+	}
+	return regressions;
+}
+
+/**
+ * Function which prints the command line options
+ */
+void printUsage(const char *name) {
+	fprintf(stderr, "usage: %s [options]\n", name);
+	fprintf(stderr, "  --out FILE       write the JSON results to FILE instead of stdout\n");
+	fprintf(stderr, "  --baseline FILE  compare against the JSON of an earlier run\n");
+	fprintf(stderr, "  --tolerance PCT  allowed change against the baseline (default 10)\n");
+	fprintf(stderr, "  --repeat N       runs of each scene, the best of each metric is kept (default 3)\n");
+	fprintf(stderr, "  --scene NAME     run only this scene:");
+	for (int s = 0; s < sceneCount; s++) { fprintf(stderr, " %s", scenes[s].name); }
+	fprintf(stderr, "\n  --threads N      threads the step is split across (default 1)\n");
+}
+
+/**
+ * Main Driver
+ */
+int main(int argc, char** argv) {
+	const char *outPath = 0, *baselinePath = 0, *only = 0;
+	double tolerance = 10;
+	int threads = 1, repeat = 3;
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if (strcmp(arg, "--out") == 0 && hasValue) { outPath = argv[++i]; }
+		else if (strcmp(arg, "--baseline") == 0 && hasValue) { baselinePath = argv[++i]; }
+		else if (strcmp(arg, "--tolerance") == 0 && hasValue) { tolerance = atof(argv[++i]); }
+		else if (strcmp(arg, "--repeat") == 0 && hasValue) { repeat = max(atoi(argv[++i]), 1); }
+		else if (strcmp(arg, "--scene") == 0 && hasValue) { only = argv[++i]; }
+		else if (strcmp(arg, "--threads") == 0 && hasValue) { threads = max(atoi(argv[++i]), 1); }
+		else {
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	string baseline;
+	if (baselinePath) {
+		FILE *f = fopen(baselinePath, "r");
+		if (!f) {
+			fprintf(stderr, "could not open baseline %s\n", baselinePath);
+			return 1;
+		}
+		char buffer[4096];
+		size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) { baseline.append(buffer, n); }
+		fclose(f);
+	}
+	vector<Result> results;
+	for (int s = 0; s < sceneCount; s++) {
+		if (only && strcmp(only, scenes[s].name) != 0) { continue; }
+		fprintf(stderr, "running %s...\n", scenes[s].name);
+		Result best = runScene(scenes[s], threads);
+		for (int run = 1; run < repeat; run++) {
+			Result r = runScene(scenes[s], threads);
+			if (r.stepsPerSecond > best.stepsPerSecond) {
+				best.seconds = r.seconds;
+				best.stepsPerSecond = r.stepsPerSecond;
+			}
+			best.p50Ms = min(best.p50Ms, r.p50Ms);
+			best.p99Ms = min(best.p99Ms, r.p99Ms);
+			best.peakRssMb = min(best.peakRssMb, r.peakRssMb);
+		}
+		results.push_back(best);
+	}
+	if (results.empty()) {
+		fprintf(stderr, "no scene named %s\n", only);
+		return 1;
+	}
+	FILE *out = outPath ? fopen(outPath, "w") : stdout;
+	if (!out) {
+		fprintf(stderr, "could not create %s\n", outPath);
+		return 1;
+	}
+	writeJson(out, results, threads);
+	if (outPath && fclose(out) != 0) {
+		fprintf(stderr, "could not write %s\n", outPath);
+		return 1;
+	}
+	if (baselinePath) {
+		int regressions = compareBaseline(baseline, results, tolerance);
+		if (regressions > 0) {
+			fprintf(stderr, "%d regression%s beyond %.1f%%\n", regressions, (regressions > 1) ? "s" : "", tolerance);
+			return 2;
+		}
+		fprintf(stderr, "no regressions beyond %.1f%%\n", tolerance);
+	}
+	return 0;
+}
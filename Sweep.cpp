@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "Simulation.h"
+#include "ScenarioFile.h"
+
+using namespace std;
+
+/**
+ * Sweep Runner
+ * runs every combination of the settings in a scenario file as its own
+ * headless simulation and prints one table of what each run did. runs go
+ * to child processes, as many at once as there are cores, so a run's
+ * memory is handed back in full when it ends and at most that many
+ * simulations are ever held. each child has the process-wide profiler to
+ * itself, which is where the bounce and collision counts come from, so
+ * they read 0 in a build with -DNO_PROFILER
+ */
+
+// what one run sends back to the runner, fixed size so it is one pipe write
+struct Outcome {
+	long steps; // steps run, fewer than asked if capped
+	long settle; // steps after the cannon stopped until nothing moved, -1 if never
+	long fired, alive, peak;
+	int64_t bounces, collisions;
+	double seconds;
+	uint64_t checksum;
+	bool capped; // stopped for holding more than the particle cap
+};
+
+// a run's outcome with what the runner saw of its process
+struct Result {
+	Outcome o;
+	double peakRssMb;
+	string status; // ok, capped, or how the process failed
+};
+
+/**
+ * Function which counts the live particles that are still moving,
+ * sleepers have no speed so only the awake ones are looked at
+ */
+size_t moving(const ParticleStore &ps) {
+	size_t n = 0;
+	for (size_t p = 0; p < ps.awake; p++) { n += (ps.life[p] > 0) & (ps.speed[p] != 0); }
+	return n;
+}
+
+/**
+ * Run function, in the child
+ * fires for the run's fire steps, then lets the scene settle until its
+ * step count is reached
+ * @param cap - live particles at which the run stops, 0 for no cap
+ */
+Outcome runOne(const ScenarioFile::Run &run, size_t cap) {
+	Outcome o;
+	memset(&o, 0, sizeof(o));
+	Simulation sim;
+	ScenarioFile::apply(run, sim);
+	long steps = (long)run.v[ScenarioFile::Steps], fire = (long)run.v[ScenarioFile::Fire];
+	if (fire < 0) { fire = steps; }
+	o.settle = -1;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (long s = 0; s < steps; s++) {
+		if (s < fire) { sim.emit(); }
+		sim.step();
+		o.steps = s + 1;
+		o.peak = max(o.peak, (long)sim.liveCount());
+		if (cap && sim.liveCount() > cap) {
+			o.capped = true;
+			break;
+		}
+		if (s >= fire && o.settle < 0 && moving(sim.particles) == 0) { o.settle = s + 1 - fire; }
+	}
+	o.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	Profiler::Stats stats = Profiler::get().stats();
+	o.bounces = stats.counts[Profiler::Bounces];
+	o.collisions = stats.counts[Profiler::CollisionHits];
+	o.fired = sim.particleCount;
+	o.alive = (long)sim.liveCount();
+	sim.particles.removeDead(); // the checksum is of the live particles, as the headless driver's
+	o.checksum = sim.particles.checksum();
+	return o;
+}
+
+// child process of a run, and the pipe its outcome comes back through
+struct Child {
+	size_t run;
+	int fd;
+};
+
+/**
+ * Run starting function
+ * forks a child that runs one combination and writes its outcome
+ * @return false if the child could not be started
+ */
+bool start(const ScenarioFile &scenario, size_t k, size_t cap, map<pid_t, Child> &children) {
+	int fds[2];
+	if (pipe(fds) != 0) { return false; }
+	fflush(stdout); fflush(stderr); // nothing buffered is written twice
+	pid_t pid = fork();
+	if (pid < 0) {
+		close(fds[0]); close(fds[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		Outcome o = runOne(scenario.run(k), cap);
+		bool sent = write(fds[1], &o, sizeof(o)) == (ssize_t)sizeof(o);
+		_exit(sent ? 0 : 1);
+	}
+	close(fds[1]);
+	Child c = { k, fds[0] };
+	children[pid] = c;
+	return true;
+}
+
+/**
+ * Run collecting function
+ * waits for any child to end and files its outcome under its run
+ */
+void collect(map<pid_t, Child> &children, vector<Result> &results) {
+	int status;
+	struct rusage usage;
+	pid_t pid;
+	while ((pid = wait4(-1, &status, 0, &usage)) < 0 && errno == EINTR) {}
+	if (pid < 0) { return; }
+	map<pid_t, Child>::iterator it = children.find(pid);
+	if (it == children.end()) { return; }
+	Result &r = results[it->second.run];
+	r.peakRssMb = usage.ru_maxrss / 1024.0;
+	bool got = read(it->second.fd, &r.o, sizeof(r.o)) == (ssize_t)sizeof(r.o); // under PIPE_BUF, so whole or not at all
+	close(it->second.fd);
+	children.erase(it);
+	if (WIFSIGNALED(status)) { r.status = string("signal ") + strsignal(WTERMSIG(status)); }
+	else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !got) { r.status = "failed"; }
+	else { r.status = r.o.capped ? "capped" : "ok"; }
+}
+
+/**
+ * Table output function
+ * one line per run: its settings, then what it did. only the settings
+ * the scenario sweeps get a column, the rest are the same for every run
+ * @param csv - comma separated rather than aligned
+ */
+void writeTable(FILE *f, const ScenarioFile &scenario, const vector<Result> &results, bool csv) {
+	vector<int> swept;
+	for (int p = 0; p < ScenarioFile::paramCount; p++) {
+		if (scenario.grid(p).size() > 1) { swept.push_back(p); }
+	}
+	const char *sep = csv ? "," : " ";
+	fprintf(f, csv ? "%s" : "%5s", "run");
+	for (size_t c = 0; c < swept.size(); c++) { fprintf(f, csv ? "%s%s" : "%s%10s", sep, ScenarioFile::paramName(swept[c])); }
+	const char *columns[] = { "steps", "fired", "alive", "peak", "bounces", "collisions", "settle", "seconds", "rss_mb",
+		"checksum", "status" };
+	for (int c = 0; c < 11; c++) { fprintf(f, csv ? "%s%s" : "%s%10s", sep, columns[c]); }
+	fprintf(f, "\n");
+	for (size_t k = 0; k < results.size(); k++) {
+		const Result &r = results[k];
+		ScenarioFile::Run run = scenario.run(k);
+		fprintf(f, csv ? "%zu" : "%5zu", k);
+		for (size_t c = 0; c < swept.size(); c++) { fprintf(f, csv ? "%s%g" : "%s%10g", sep, run.v[swept[c]]); }
+		char settle[32];
+		if (r.o.settle < 0) { strcpy(settle, "-"); }
+		else { snprintf(settle, sizeof(settle), "%ld", r.o.settle); }
+		fprintf(f, csv ? "%s%ld%s%ld%s%ld%s%ld%s%lld%s%lld%s%s%s%.3f%s%.1f%s%016llx%s%s\n"
+			: "%s%10ld%s%10ld%s%10ld%s%10ld%s%10lld%s%10lld%s%10s%s%10.3f%s%10.1f%s%016llx%s%s\n",
+			sep, r.o.steps, sep, r.o.fired, sep, r.o.alive, sep, r.o.peak, sep, (long long)r.o.bounces,
+			sep, (long long)r.o.collisions, sep, settle, sep, r.o.seconds, sep, r.peakRssMb,
+			sep, (unsigned long long)r.o.checksum, sep, r.status.c_str());
+	}
+}
+
+/**
+ * Function which prints the command line options
+ */
+void printUsage(const char *name) {
+	fprintf(stderr, "usage: %s [options] SCENARIO\n", name);
+	fprintf(stderr, "  --jobs N           runs at once (default one per core)\n");
+	fprintf(stderr, "  --max-particles N  stop a run once it holds more live particles (default 0, no cap)\n");
+	fprintf(stderr, "  --csv FILE         also write the table to FILE as CSV\n");
+	fprintf(stderr, "  --dry-run          list the runs without running them\n");
+	fprintf(stderr, "settings a scenario file can sweep:");
+	for (int p = 0; p < ScenarioFile::paramCount; p++) { fprintf(stderr, " %s", ScenarioFile::paramName(p)); }
+	fprintf(stderr, "\n");
+}
+
+/**
+ * Main Driver
+ */
+int main(int argc, char** argv) {
+	const char *path = 0, *csvPath = 0;
+	int jobs = max((int)thread::hardware_concurrency(), 1);
+	size_t cap = 0;
+	bool dryRun = false;
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if (strcmp(arg, "--jobs") == 0 && hasValue) { jobs = max(atoi(argv[++i]), 1); }
+		else if (strcmp(arg, "--max-particles") == 0 && hasValue) { cap = strtoull(argv[++i], 0, 10); }
+		else if (strcmp(arg, "--csv") == 0 && hasValue) { csvPath = argv[++i]; }
+		else if (strcmp(arg, "--dry-run") == 0) { dryRun = true; }
+		else if (arg[0] != '-' && !path) { path = arg; }
+		else {
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	ScenarioFile scenario;
+	if (!path) {
+		printUsage(argv[0]);
+		return 1;
+	}
+	if (!scenario.load(path)) {
+		fprintf(stderr, "%s\n", scenario.getError().c_str());
+		return 1;
+	}
+	size_t total = scenario.runs();
+	vector<Result> results(total);
+	for (size_t k = 0; k < total; k++) { results[k].o.settle = -1; }
+	if (dryRun) {
+		for (size_t k = 0; k < total; k++) { results[k].status = "not run"; }
+		writeTable(stdout, scenario, results, false);
+		return 0;
+	}
+	fprintf(stderr, "%zu runs, %d at once\n", total, jobs);
+	map<pid_t, Child> children;
+	size_t next = 0;
+	while (next < total || !children.empty()) {
+		for (; next < total && children.size() < (size_t)jobs; next++) {
+			if (!start(scenario, next, cap, children)) { results[next].status = "not started"; }
+		}
+		if (!children.empty()) { collect(children, results); }
+		fprintf(stderr, "\r%zu of %zu done", next - children.size(), total);
+	}
+	fprintf(stderr, "\n");
+	writeTable(stdout, scenario, results, false);
+	if (csvPath) {
+		FILE *f = fopen(csvPath, "w");
+		if (!f) {
+			fprintf(stderr, "could not create %s\n", csvPath);
+			return 1;
+		}
+		writeTable(f, scenario, results, true);
+		if (fclose(f) != 0) {
+			fprintf(stderr, "could not write %s\n", csvPath);
+			return 1;
+		}
+	}
+	for (size_t k = 0; k < total; k++) {
+		if (results[k].status != "ok" && results[k].status != "capped") { return 2; }
+	}
+	return 0;
+}
@@ -0,0 +1,201 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+/**
+ * ThreadPool Class
+ * fixed set of worker threads that split a loop over [0, n) between them.
+ * the range is cut into chunks that workers claim one at a time, so the
+ * thread a chunk runs on changes from run to run but the chunks do not.
+ * the calling thread works too, so a pool of size 1 has no workers.
+ * for tasks of very uneven cost there is also a work-stealing loop: each
+ * thread starts with an even share of the tasks and, once it runs out,
+ * takes half of what another thread has left
+ */
+
+class ThreadPool {
+private:
+	typedef std::function<void(size_t, size_t, int)> Task;
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable wake; // signals workers that a loop is ready
+	std::condition_variable finished; // signals the caller that workers are idle
+	// tasks a thread has left, it takes from the front and thieves from the back
+	struct Share {
+		std::atomic<uint64_t> range; // first task in the high half, end in the low half
+		char pad[64 - sizeof(std::atomic<uint64_t>)]; // a cache line each
+	};
+	const Task *task; // loop body of the current run
+	size_t total, chunk; // range and chunk size of the current run
+	std::atomic<size_t> next; // next unclaimed index
+	bool stealing; // current run is a work-stealing one
+	std::unique_ptr<Share[]> shares; // one per thread
+	int busy; // workers still inside the current run
+	unsigned int generation; // bumped once per run
+	bool stopping;
+
+	static uint64_t pack(uint32_t begin, uint32_t end) {
+		return ((uint64_t)begin << 32) | end;
+	}
+	// claims chunks until the range runs out
+	void runChunks(int worker) {
+		for (;;) {
+			size_t begin = next.fetch_add(chunk);
+			if (begin >= total) { return; }
+			(*task)(begin, std::min(begin + chunk, total), worker);
+		}
+	}
+	// takes the first task of a thread's own share
+	bool takeOwn(int worker, uint32_t &t) {
+		std::atomic<uint64_t> &range = shares[worker].range;
+		uint64_t r = range.load();
+		for (;;) {
+			uint32_t begin = (uint32_t)(r >> 32), end = (uint32_t)r;
+			if (begin >= end) { return false; }
+			if (range.compare_exchange_weak(r, pack(begin + 1, end))) {
+				t = begin;
+				return true;
+			}
+		}
+	}
+	/**
+	 * Stealing function
+	 * moves the back half of the first other share with tasks left into
+	 * the thief's own, which is empty. a stolen range holds tasks no
+	 * share has held before, so a thief can never mistake a refilled
+	 * share for the one it read
+	 * @return false if every other share was empty
+	 */
+	bool steal(int worker) {
+		for (int k = 1; k < size(); k++) {
+			std::atomic<uint64_t> &range = shares[(worker + k) % size()].range;
+			uint64_t r = range.load();
+			for (;;) {
+				uint32_t begin = (uint32_t)(r >> 32), end = (uint32_t)r;
+				if (begin >= end) { break; }
+				uint32_t mid = end - (end - begin + 1) / 2;
+				if (range.compare_exchange_weak(r, pack(begin, mid))) {
+					shares[worker].range.store(pack(mid, end));
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+	// runs a thread's own tasks, then stolen ones until none are left anywhere
+	void runStealing(int worker) {
+		uint32_t t;
+		do {
+			while (takeOwn(worker, t)) { (*task)(t, t + 1, worker); }
+		} while (steal(worker));
+	}
+	void run(int worker) {
+		if (stealing) { runStealing(worker); }
+		else { runChunks(worker); }
+	}
+	// waits for the workers to finish the current run
+	void wait() {
+		std::unique_lock<std::mutex> guard(lock);
+		while (busy != 0) { finished.wait(guard); }
+	}
+	// body of each worker thread
+	void workerLoop(int worker) {
+		unsigned int seen = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				while (!stopping && generation == seen) { wake.wait(guard); }
+				if (stopping) { return; }
+				seen = generation;
+			}
+			run(worker);
+			std::lock_guard<std::mutex> guard(lock);
+			if (--busy == 0) { finished.notify_one(); }
+		}
+	}
+public:
+	/**
+	 * ThreadPool Constructor
+	 * @param n - number of threads including the caller
+	 */
+	ThreadPool(int n) : task(0), total(0), chunk(1), next(0), stealing(false), shares(new Share[std::max(n, 1)]),
+		busy(0), generation(0), stopping(false) {
+		for (int i = 1; i < n; i++) {
+			workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+		}
+	}
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < workers.size(); i++) { workers[i].join(); }
+	}
+	// number of threads taking part in a loop
+	int size() const {
+		return (int)workers.size() + 1;
+	}
+	/**
+	 * Parallel loop function
+	 * calls f(begin, end, worker) over chunks covering [0, n) and
+	 * returns once every chunk is done. worker is 0..size()-1 and
+	 * can index per-thread scratch space
+	 * @param n - length of the range
+	 * @param grain - chunk size
+	 * @param f - loop body
+	 */
+	void parallelFor(size_t n, size_t grain, const Task &f) {
+		if (workers.empty() || n <= grain) { // not worth waking anyone
+			if (n > 0) { f(0, n, 0); }
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			task = &f;
+			total = n;
+			chunk = grain;
+			next = 0;
+			stealing = false;
+			busy = (int)workers.size();
+			generation++;
+		}
+		wake.notify_all();
+		runChunks(0);
+		wait();
+	}
+	/**
+	 * Work-stealing loop function
+	 * calls f(t, t + 1, worker) once for every task t in [0, n). tasks
+	 * near each other go to the same thread first, and a thread that
+	 * runs out steals from the back of another's share
+	 * @param n - number of tasks, below 2^32
+	 * @param f - task body
+	 */
+	void stealingFor(size_t n, const Task &f) {
+		if (workers.empty() || n <= 1) {
+			for (size_t t = 0; t < n; t++) { f(t, t + 1, 0); }
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			task = &f;
+			stealing = true;
+			for (int w = 0; w < size(); w++) {
+				shares[w].range.store(pack((uint32_t)(n * w / size()), (uint32_t)(n * (w + 1) / size())));
+			}
+			busy = (int)workers.size();
+			generation++;
+		}
+		wake.notify_all();
+		runStealing(0);
+		wait();
+	}
+};
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <iostream>
+#include "TrajectoryFile.h"
+
+using namespace std;
+
+/**
+ * Trajectory Reader
+ * prints what a trajectory file holds, or the particles of one step
+ * as CSV, seeking straight to the chunk the step is in
+ */
+
+/**
+ * Function which prints the command line options
+ */
+void printUsage(const char *name) {
+	cout << "usage: " << name << " info FILE" << endl;
+	cout << "       " << name << " dump FILE STEP [N]" << endl;
+	cout << "  info           chunks, step range and size of the file" << endl;
+	cout << "  dump           particles of one step as CSV, the first N or all" << endl;
+}
+
+/**
+ * Function which prints the chunks and step range of a file
+ */
+void printInfo(TrajectoryReader &reader, const char *path) {
+	const vector<TrajectoryIndex> &chunks = reader.getChunks();
+	struct stat st;
+	cout << "File: " << path << " (" << ((stat(path, &st) == 0) ? st.st_size : 0) << " bytes)" << endl;
+	cout << "Index: " << (reader.hasIndex() ? "yes" : "no, file was not closed, chunks scanned") << endl;
+	cout << "Chunks: " << chunks.size() << endl;
+	if (!chunks.empty()) {
+		cout << "Steps: " << chunks.front().firstStep << " to " << chunks.back().lastStep << endl;
+	}
+}
+
+/**
+ * Function which prints one step as CSV
+ * @param n - particles to print, negative for all
+ */
+bool printStep(TrajectoryReader &reader, long step, long n) {
+	TrajectoryReader::Frame f;
+	if (!reader.readStep(step, f)) { return false; }
+	size_t count = (n < 0) ? f.id.size() : min((size_t)n, f.id.size());
+	cout << "step,id,x,y,z,vx,vy,vz,color,life" << endl;
+	for (size_t i = 0; i < count; i++) {
+		cout << f.step << "," << f.id[i] << "," << f.x[i] << "," << f.y[i] << "," << f.z[i] << ","
+			<< f.vx[i] << "," << f.vy[i] << "," << f.vz[i] << "," << (int)f.color[i] << "," << (int)f.life[i] << endl;
+	}
+	return true;
+}
+
+/**
+ * Main Driver
+ */
+int main(int argc, char** argv) {
+	if (argc < 3 || (strcmp(argv[1], "info") != 0 && strcmp(argv[1], "dump") != 0)
+		|| (strcmp(argv[1], "dump") == 0 && argc < 4)) {
+		printUsage(argv[0]);
+		return 1;
+	}
+	TrajectoryReader reader;
+	if (!reader.open(argv[2])) {
+		cout << "could not open trajectory " << argv[2] << endl;
+		return 1;
+	}
+	if (strcmp(argv[1], "info") == 0) {
+		printInfo(reader, argv[2]);
+		return 0;
+	}
+	long step = atol(argv[3]);
+	if (!printStep(reader, step, (argc > 4) ? atol(argv[4]) : -1)) {
+		cout << "step " << step << " is not in " << argv[2] << endl;
+		return 1;
+	}
+	return 0;
+}
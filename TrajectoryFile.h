@@ -0,0 +1,415 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ParticleStore.h"
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+/**
+ * Trajectory file layout
+ * a header, then chunks of consecutive recorded steps, then an index of
+ * the chunks and a trailer pointing at it. each chunk is a chunk header
+ * and a payload, zlib compressed when the writer was asked to and built
+ * with USE_ZLIB. a payload holds one frame per recorded step: a frame
+ * header, then the columns id, x, y, z, vx, vy, vz, color and life, each
+ * count entries long, and the frame is padded so the next one starts
+ * 8-byte aligned.
+ * velocity is the step's displacement, dy + speed vertically. a file that
+ * was never closed has no index, its chunks are found by hopping from
+ * chunk header to chunk header instead
+ */
+
+struct TrajectoryHeader {
+	char magic[4]; // "PTRJ"
+	uint32_t version;
+	uint32_t compressed; // chunks may be zlib compressed
+	uint32_t unused;
+};
+struct TrajectoryChunk {
+	char magic[4]; // "CHNK"
+	uint32_t frames;
+	uint32_t codec; // 0 raw, 1 zlib
+	uint32_t unused;
+	int64_t firstStep, lastStep;
+	uint64_t rawBytes, storedBytes; // payload before and after compression
+};
+struct TrajectoryFrame {
+	int64_t step;
+	uint64_t count; // particles in the frame
+};
+struct TrajectoryIndex {
+	int64_t firstStep, lastStep;
+	uint64_t offset; // of the chunk header
+};
+struct TrajectoryTrailer {
+	uint64_t indexOffset;
+	uint64_t chunks;
+	char magic[8]; // "PTRJIDX"
+};
+
+// bytes a frame of n particles takes in a payload, 7 four-byte and 2 one-byte columns padded to 8
+inline size_t trajectoryFrameBytes(size_t n) {
+	return sizeof(TrajectoryFrame) + ((n * 30 + 7) & ~(size_t)7);
+}
+
+/**
+ * TrajectoryWriter Class
+ * streams the particles of chosen steps to a trajectory file.
+ * record() only copies the particles into the chunk being filled, a
+ * full chunk is swapped with the one the I/O thread is done with and
+ * compressed and written there. the step only waits if the disk falls
+ * a whole chunk behind, which is counted as a stall
+ */
+
+class TrajectoryWriter {
+public:
+	enum { version = 2 };
+	TrajectoryWriter() : file(0), compress(false), framesPerChunk(16), stalls(0), failed(false),
+		pending(false), stopping(false) {
+		resetChunk();
+	}
+	~TrajectoryWriter() {
+		close();
+	}
+	/**
+	 * File opening function
+	 * @param path - file to write, replaced if it exists
+	 * @param z - compress chunks, ignored unless built with USE_ZLIB
+	 * @param fpc - recorded steps per chunk
+	 * @return false if the file could not be created
+	 */
+	bool open(const char *path, bool z, int fpc) {
+		close();
+		file = fopen(path, "wb");
+		if (!file) { return false; }
+#ifdef USE_ZLIB
+		compress = z;
+#else
+		compress = false;
+		(void)z;
+#endif
+		framesPerChunk = (fpc > 0) ? fpc : 1;
+		stalls = 0; failed = false; pending = false; stopping = false;
+		index.clear();
+		resetChunk();
+		TrajectoryHeader h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, "PTRJ", 4);
+		h.version = version;
+		h.compressed = compress;
+		failed = fwrite(&h, sizeof(h), 1, file) != 1;
+		io = std::thread(&TrajectoryWriter::ioLoop, this);
+		return true;
+	}
+	bool isOpen() const {
+		return file != 0;
+	}
+	// times record() had to wait for the I/O thread
+	long getStalls() const {
+		return stalls;
+	}
+	/**
+	 * Step recording function
+	 * appends the live particles as they are now as one frame, dead ones
+	 * the record has not dropped yet are left out
+	 * @param ps - the particle record
+	 * @param step - step number the frame is filed under
+	 */
+	void record(const ParticleStore &ps, int64_t step) {
+		if (!file) { return; }
+		size_t n = ps.alive();
+		size_t at = filling.size();
+		filling.resize(at + trajectoryFrameBytes(n));
+		char *out = &filling[at];
+		TrajectoryFrame f = { step, n };
+		memcpy(out, &f, sizeof(f)); out += sizeof(f);
+		out = column(out, ps, ps.id.data()); out = column(out, ps, ps.x.data());
+		out = column(out, ps, ps.y.data()); out = column(out, ps, ps.z.data());
+		out = column(out, ps, ps.dx.data());
+		float *vy = (float*)out; // frames keep the columns 4-byte aligned
+		for (size_t i = 0; i < ps.count(); i++) {
+			if (ps.life[i] > 0) { *vy++ = ps.dy[i] + ps.speed[i]; }
+		}
+		out += n * 4;
+		out = column(out, ps, ps.dz.data());
+		for (size_t i = 0; i < ps.count(); i++) {
+			if (ps.life[i] > 0) { *out++ = (char)ps.color[i]; }
+		}
+		for (size_t i = 0; i < ps.count(); i++) {
+			if (ps.life[i] > 0) { *out++ = (char)ps.life[i]; }
+		}
+		if (chunk.frames == 0) { chunk.firstStep = step; }
+		chunk.lastStep = step;
+		if (++chunk.frames == (uint32_t)framesPerChunk) { flush(); }
+	}
+	/**
+	 * File closing function
+	 * writes the last chunk and the index and waits for the I/O thread
+	 * @return false if anything failed to write
+	 */
+	bool close() {
+		if (!file) { return true; }
+		if (chunk.frames > 0) { flush(); }
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_one();
+		io.join();
+		TrajectoryTrailer t;
+		memset(&t, 0, sizeof(t));
+		t.indexOffset = ftello(file);
+		t.chunks = index.size();
+		memcpy(t.magic, "PTRJIDX", 7);
+		if (!index.empty() && fwrite(index.data(), sizeof(TrajectoryIndex), index.size(), file) != index.size()) { failed = true; }
+		if (fwrite(&t, sizeof(t), 1, file) != 1) { failed = true; }
+		if (fclose(file) != 0) { failed = true; }
+		file = 0;
+		return !failed;
+	}
+private:
+	FILE *file;
+	bool compress;
+	int framesPerChunk;
+	long stalls;
+	bool failed;
+	std::vector<char> filling, writing; // chunk being recorded, chunk being written
+	TrajectoryChunk chunk, writingChunk; // their headers
+	std::vector<TrajectoryIndex> index; // chunks written so far, only touched by the I/O thread
+	std::vector<unsigned char> packed; // compression output
+	std::thread io;
+	std::mutex lock;
+	std::condition_variable wake, done;
+	bool pending; // writing holds a chunk the I/O thread has not finished
+	bool stopping;
+
+	// copies a 4-byte column of the live particles, whole when none are dead
+	template <class T>
+	static char *column(char *out, const ParticleStore &ps, const T *v) {
+		if (ps.dead == 0) {
+			memcpy(out, v, ps.count() * 4);
+			return out + ps.count() * 4;
+		}
+		for (size_t i = 0; i < ps.count(); i++) {
+			if (ps.life[i] > 0) {
+				memcpy(out, &v[i], 4);
+				out += 4;
+			}
+		}
+		return out;
+	}
+	void resetChunk() {
+		memset(&chunk, 0, sizeof(chunk));
+		memcpy(chunk.magic, "CHNK", 4);
+		filling.clear();
+	}
+	// hands the filled chunk to the I/O thread
+	void flush() {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			if (pending) { stalls++; }
+			while (pending) { done.wait(guard); }
+			filling.swap(writing);
+			writingChunk = chunk;
+			pending = true;
+		}
+		wake.notify_one();
+		resetChunk();
+	}
+	// compresses and writes one chunk, on the I/O thread
+	void writeChunk() {
+		TrajectoryChunk h = writingChunk;
+		const void *payload = writing.data();
+		h.rawBytes = h.storedBytes = writing.size();
+#ifdef USE_ZLIB
+		if (compress) {
+			uLongf size = compressBound(writing.size());
+			packed.resize(size);
+			if (compress2(packed.data(), &size, (const Bytef*)writing.data(), writing.size(), Z_BEST_SPEED) == Z_OK) {
+				h.codec = 1;
+				h.storedBytes = size;
+				payload = packed.data();
+			}
+		}
+#endif
+		TrajectoryIndex entry = { h.firstStep, h.lastStep, (uint64_t)ftello(file) };
+		if (fwrite(&h, sizeof(h), 1, file) != 1 || fwrite(payload, 1, h.storedBytes, file) != h.storedBytes) {
+			failed = true;
+		}
+		index.push_back(entry);
+	}
+	// body of the I/O thread
+	void ioLoop() {
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				while (!pending && !stopping) { wake.wait(guard); }
+				if (!pending) { return; } // stopping with nothing left
+			}
+			writeChunk();
+			std::lock_guard<std::mutex> guard(lock);
+			pending = false;
+			done.notify_one();
+		}
+	}
+};
+
+/**
+ * TrajectoryReader Class
+ * finds chunks through the index at the end of the file, so reading
+ * any step costs one seek and one chunk, whatever the file size
+ */
+
+class TrajectoryReader {
+public:
+	// one recorded step, columns as in the file
+	struct Frame {
+		int64_t step;
+		std::vector<int32_t> id;
+		std::vector<float> x, y, z, vx, vy, vz;
+		std::vector<unsigned char> color, life;
+	};
+	TrajectoryReader() : file(0), fileBytes(0), indexed(false) {}
+	~TrajectoryReader() {
+		close();
+	}
+	/**
+	 * File opening function
+	 * @return false if the file is missing or not a trajectory of this version
+	 */
+	bool open(const char *path) {
+		close();
+		file = fopen(path, "rb");
+		if (!file) { return false; }
+		TrajectoryHeader h;
+		if (fread(&h, sizeof(h), 1, file) != 1 || memcmp(h.magic, "PTRJ", 4) != 0
+			|| h.version != TrajectoryWriter::version) {
+			close();
+			return false;
+		}
+		if (fseeko(file, 0, SEEK_END) != 0) {
+			close();
+			return false;
+		}
+		fileBytes = ftello(file);
+		indexed = readIndex() || scanChunks();
+		return true;
+	}
+	void close() {
+		if (file) { fclose(file); }
+		file = 0;
+		chunks.clear();
+	}
+	// chunks in the file, in step order
+	const std::vector<TrajectoryIndex> &getChunks() const {
+		return chunks;
+	}
+	// false if the writer never closed the file and chunks had to be scanned
+	bool hasIndex() const {
+		return indexed;
+	}
+	/**
+	 * Step reading function
+	 * @param step - step to read
+	 * @param out - the frame, filled in
+	 * @return false if the step was not recorded or could not be read
+	 */
+	bool readStep(int64_t step, Frame &out) {
+		size_t lo = 0, hi = chunks.size(); // first chunk ending at or after step
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (chunks[mid].lastStep < step) { lo = mid + 1; }
+			else { hi = mid; }
+		}
+		if (lo == chunks.size() || chunks[lo].firstStep > step) { return false; }
+		TrajectoryChunk h;
+		if (fseeko(file, chunks[lo].offset, SEEK_SET) != 0 || fread(&h, sizeof(h), 1, file) != 1) { return false; }
+		if (!readPayload(h)) { return false; }
+		const char *at = payload.data(), *end = at + payload.size();
+		while (at + sizeof(TrajectoryFrame) <= end) {
+			TrajectoryFrame f;
+			memcpy(&f, at, sizeof(f));
+			at += sizeof(f);
+			if (f.count > (uint64_t)(end - at) / 30) { return false; } // more than the payload holds
+			size_t n = f.count;
+			size_t bytes = trajectoryFrameBytes(n) - sizeof(f);
+			if ((size_t)(end - at) < bytes) { return false; }
+			if (f.step != step) { // skip to the next frame
+				at += bytes;
+				continue;
+			}
+			out.step = f.step;
+			column(at, out.id, n); column(at, out.x, n); column(at, out.y, n); column(at, out.z, n);
+			column(at, out.vx, n); column(at, out.vy, n); column(at, out.vz, n);
+			column(at, out.color, n); column(at, out.life, n);
+			return true;
+		}
+		return false;
+	}
+private:
+	FILE *file;
+	uint64_t fileBytes; // size of the file, which every count read from it has to fit in
+	bool indexed;
+	std::vector<TrajectoryIndex> chunks;
+	std::vector<char> payload, stored;
+
+	template <class T>
+	static void column(const char *&at, std::vector<T> &v, size_t n) {
+		v.resize(n);
+		if (n > 0) { memcpy(v.data(), at, n * sizeof(T)); }
+		at += n * sizeof(T);
+	}
+	// reads the index the writer left at the end
+	bool readIndex() {
+		TrajectoryTrailer t;
+		if (fseeko(file, -(off_t)sizeof(t), SEEK_END) != 0 || fread(&t, sizeof(t), 1, file) != 1
+			|| memcmp(t.magic, "PTRJIDX", 8) != 0) {
+			return false;
+		}
+		if (t.indexOffset > fileBytes || t.chunks > (fileBytes - t.indexOffset) / sizeof(TrajectoryIndex)) { return false; }
+		chunks.resize(t.chunks);
+		if (fseeko(file, t.indexOffset, SEEK_SET) != 0
+			|| (t.chunks > 0 && fread(chunks.data(), sizeof(TrajectoryIndex), t.chunks, file) != t.chunks)) {
+			chunks.clear();
+			return false;
+		}
+		return true;
+	}
+	// rebuilds the index of an unclosed file from the chunk headers
+	bool scanChunks() {
+		uint64_t size = fileBytes, offset = sizeof(TrajectoryHeader);
+		TrajectoryChunk h;
+		while (fseeko(file, offset, SEEK_SET) == 0 && fread(&h, sizeof(h), 1, file) == 1
+			&& memcmp(h.magic, "CHNK", 4) == 0 && offset + sizeof(h) + h.storedBytes <= size) {
+			TrajectoryIndex entry = { h.firstStep, h.lastStep, offset };
+			chunks.push_back(entry);
+			offset += sizeof(h) + h.storedBytes;
+		}
+		return false;
+	}
+	// reads and if need be decompresses the payload following a chunk header
+	bool readPayload(const TrajectoryChunk &h) {
+		if (h.storedBytes > fileBytes) { return false; }
+		if (h.codec == 0) {
+			payload.resize(h.storedBytes);
+			return fread(payload.data(), 1, h.storedBytes, file) == h.storedBytes;
+		}
+#ifdef USE_ZLIB
+		if (h.rawBytes > h.storedBytes * 1032) { return false; } // past the most zlib can expand
+		stored.resize(h.storedBytes);
+		payload.resize(h.rawBytes);
+		uLongf size = h.rawBytes;
+		return fread(stored.data(), 1, h.storedBytes, file) == h.storedBytes
+			&& uncompress((Bytef*)payload.data(), &size, (const Bytef*)stored.data(), h.storedBytes) == Z_OK
+			&& size == h.rawBytes;
+#else
+		return false; // compressed chunk, but built without USE_ZLIB
+#endif
+	}
+};
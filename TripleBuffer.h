@@ -0,0 +1,36 @@
+#pragma once
+#include <atomic>
+
+/**
+ * TripleBuffer Class
+ * hands values from one writer thread to one reader thread without
+ * either waiting. the writer fills its own slot and publishes it by
+ * swapping it with the shared middle slot, the reader takes the middle
+ * slot in exchange for its own whenever something new was published.
+ * the reader always sees a complete value, the newest one published
+ */
+
+template <class T>
+class TripleBuffer {
+private:
+	enum { fresh = 4 }; // set on the middle index while it is unread
+	T slots[3];
+	std::atomic<int> middle; // slot last published, plus the fresh bit
+	int back; // slot the writer fills
+	int front; // slot the reader holds
+public:
+	TripleBuffer() : middle(1), back(0), front(2) {}
+	// slot to fill before publishing, only for the writer
+	T &write() {
+		return slots[back];
+	}
+	// hands the filled slot to the reader
+	void publish() {
+		back = middle.exchange(back | fresh) & 3;
+	}
+	// newest published value, only for the reader
+	T &read() {
+		if (middle.load() & fresh) { front = middle.exchange(front) & 3; }
+		return slots[front];
+	}
+};